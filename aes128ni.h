@@ -8,8 +8,11 @@
 #include <assert.h>
 #if defined(_MSC_VER)
 #include <intrin.h> // __cpuid()
+#include <stdlib.h> // _byteswap_uint64()
+#define aes128ni_bswap64 _byteswap_uint64
 #else
 #include <cpuid.h>
+#define aes128ni_bswap64 __builtin_bswap64
 #endif
 //compile using gcc and following arguments: -g;-O0;-Wall;-msse2;-msse;-march=native;-maes
 
@@ -162,6 +165,34 @@ public:
 		}
 	}
 
+	// Шифрование c CBC четырех независимых буферов одного размера кратно 16 байт.
+	// Раунды четырех цепочек чередуются, что загружает конвейер AES в отличие от одной цепочки
+	void cbc_encrypt4(void *buffer[4], size_t size) {
+		assert((size % sizeof(__m128i)) == 0); // Размер должен быть кратен 16
+		__m128i *p0 = (__m128i *)buffer[0], *p1 = (__m128i *)buffer[1], *p2 = (__m128i *)buffer[2], *p3 = (__m128i *)buffer[3];
+		__m128i m0 = _mm_setzero_si128(), m1 = m0, m2 = m0, m3 = m0;
+		for (size_t i = 0; i < size / sizeof(__m128i); i++) {
+			m0 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p0 + i), m0), key_schedule[0]);
+			m1 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p1 + i), m1), key_schedule[0]);
+			m2 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p2 + i), m2), key_schedule[0]);
+			m3 = _mm_xor_si128(_mm_xor_si128(_mm_loadu_si128(p3 + i), m3), key_schedule[0]);
+			for (int r = 1; r < 10; r++) {
+				m0 = _mm_aesenc_si128(m0, key_schedule[r]);
+				m1 = _mm_aesenc_si128(m1, key_schedule[r]);
+				m2 = _mm_aesenc_si128(m2, key_schedule[r]);
+				m3 = _mm_aesenc_si128(m3, key_schedule[r]);
+			}
+			m0 = _mm_aesenclast_si128(m0, key_schedule[10]);
+			m1 = _mm_aesenclast_si128(m1, key_schedule[10]);
+			m2 = _mm_aesenclast_si128(m2, key_schedule[10]);
+			m3 = _mm_aesenclast_si128(m3, key_schedule[10]);
+			_mm_storeu_si128(p0 + i, m0);
+			_mm_storeu_si128(p1 + i, m1);
+			_mm_storeu_si128(p2 + i, m2);
+			_mm_storeu_si128(p3 + i, m3);
+		}
+	}
+
 	// Расшифровка блока размером кратно 16 байт c CBC
 	void cbc_decrypt(void *buffer, size_t size) {
 		assert((size % sizeof(__m128i)) == 0); // Размер должен быть кратен 16
@@ -175,6 +206,74 @@ public:
 		}
 	}
 
+	// Расшифровка c CBC из src в dst (можно src == dst) размером кратно 16 байт. iv - предыдущий блок
+	// шифротекста, для начала буфера - вектор инициализации, NULL - нулевой. Блоки расшифровываются
+	// независимо, поэтому по 4 одновременно для загрузки конвейера AES
+	void cbc_decrypt(const void *src, void *dst, size_t size, const void *iv) {
+		assert((size % sizeof(__m128i)) == 0); // Размер должен быть кратен 16
+		const __m128i *s = (const __m128i *)src;
+		__m128i *d = (__m128i *)dst;
+		size_t n = size / sizeof(__m128i), i = 0;
+		__m128i prev = (iv != NULL ? _mm_loadu_si128((const __m128i *)iv) : _mm_setzero_si128());
+		for (; i + 4 <= n; i += 4) {
+			__m128i c0 = _mm_loadu_si128(s + i), c1 = _mm_loadu_si128(s + i + 1), c2 = _mm_loadu_si128(s + i + 2), c3 = _mm_loadu_si128(s + i + 3);
+			__m128i m0 = _mm_xor_si128(c0, key_schedule[10]), m1 = _mm_xor_si128(c1, key_schedule[10]);
+			__m128i m2 = _mm_xor_si128(c2, key_schedule[10]), m3 = _mm_xor_si128(c3, key_schedule[10]);
+			for (int r = 11; r < 20; r++) {
+				m0 = _mm_aesdec_si128(m0, key_schedule[r]);
+				m1 = _mm_aesdec_si128(m1, key_schedule[r]);
+				m2 = _mm_aesdec_si128(m2, key_schedule[r]);
+				m3 = _mm_aesdec_si128(m3, key_schedule[r]);
+			}
+			_mm_storeu_si128(d + i, _mm_xor_si128(_mm_aesdeclast_si128(m0, key_schedule[0]), prev));
+			_mm_storeu_si128(d + i + 1, _mm_xor_si128(_mm_aesdeclast_si128(m1, key_schedule[0]), c0));
+			_mm_storeu_si128(d + i + 2, _mm_xor_si128(_mm_aesdeclast_si128(m2, key_schedule[0]), c1));
+			_mm_storeu_si128(d + i + 3, _mm_xor_si128(_mm_aesdeclast_si128(m3, key_schedule[0]), c2));
+			prev = c3;
+		}
+		for (; i < n; i++) {
+			__m128i c = _mm_loadu_si128(s + i), v;
+			aes128ni_dec(key_schedule, &c, &v);
+			_mm_storeu_si128(d + i, _mm_xor_si128(v, prev));
+			prev = c;
+		}
+	}
+
+	// Шифрование/расшифровка в режиме CTR размером кратно 16 байт. Блок счетчика - iv, последние 8 байт
+	// которого счетчик big-endian, увеличенный на номер блока. block - номер первого блока буфера в
+	// потоке, чтобы части одного потока обрабатывались независимо. По 4 блока одновременно
+	void ctr(void *buffer, size_t size, const void *iv, uint64_t block = 0) {
+		assert((size % sizeof(__m128i)) == 0); // Размер должен быть кратен 16
+		__m128i *p = (__m128i *)buffer;
+		size_t n = size / sizeof(__m128i), i = 0;
+		int64_t nonce;
+		uint64_t count;
+		memcpy(&nonce, iv, 8);
+		memcpy(&count, (const uint8_t *)iv + 8, 8);
+		count = aes128ni_bswap64(count) + block;
+		for (; i + 4 <= n; i += 4, count += 4) {
+			__m128i m0 = _mm_xor_si128(_mm_set_epi64x((int64_t)aes128ni_bswap64(count), nonce), key_schedule[0]);
+			__m128i m1 = _mm_xor_si128(_mm_set_epi64x((int64_t)aes128ni_bswap64(count + 1), nonce), key_schedule[0]);
+			__m128i m2 = _mm_xor_si128(_mm_set_epi64x((int64_t)aes128ni_bswap64(count + 2), nonce), key_schedule[0]);
+			__m128i m3 = _mm_xor_si128(_mm_set_epi64x((int64_t)aes128ni_bswap64(count + 3), nonce), key_schedule[0]);
+			for (int r = 1; r < 10; r++) {
+				m0 = _mm_aesenc_si128(m0, key_schedule[r]);
+				m1 = _mm_aesenc_si128(m1, key_schedule[r]);
+				m2 = _mm_aesenc_si128(m2, key_schedule[r]);
+				m3 = _mm_aesenc_si128(m3, key_schedule[r]);
+			}
+			_mm_storeu_si128(p + i, _mm_xor_si128(_mm_loadu_si128(p + i), _mm_aesenclast_si128(m0, key_schedule[10])));
+			_mm_storeu_si128(p + i + 1, _mm_xor_si128(_mm_loadu_si128(p + i + 1), _mm_aesenclast_si128(m1, key_schedule[10])));
+			_mm_storeu_si128(p + i + 2, _mm_xor_si128(_mm_loadu_si128(p + i + 2), _mm_aesenclast_si128(m2, key_schedule[10])));
+			_mm_storeu_si128(p + i + 3, _mm_xor_si128(_mm_loadu_si128(p + i + 3), _mm_aesenclast_si128(m3, key_schedule[10])));
+		}
+		for (; i < n; i++, count++) {
+			__m128i c = _mm_set_epi64x((int64_t)aes128ni_bswap64(count), nonce), k;
+			aes128ni_enc(key_schedule, &c, &k);
+			_mm_storeu_si128(p + i, _mm_xor_si128(_mm_loadu_si128(p + i), k));
+		}
+	}
+
 	// Шифрование данных XOR с предыдущим
 	void xor_encrypt(void* buf, size_t size) {
 		assert((size % sizeof(__m128i)) == 0); // Размер должен быть кратен 16
@@ -213,5 +312,36 @@ static void aes128ni_t_test() {
 	if (memcmp(buf, cipher, 16) != 0) printf("AES-128 encrypt error\n");
 	aes.decrypt(buf, 16);
 	if (memcmp(buf, plain, 16) != 0) printf("AES-128 decrypt error\n");
+
+	// CTR, NIST SP 800-38A F.5.1: 4 блока одним вызовом (по 4 параллельно) и по одному с номера блока
+	uint8_t ctr_iv[] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+	uint8_t ctr_plain[] = {
+		0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+		0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+		0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+		0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+	uint8_t ctr_cipher[] = {
+		0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+		0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+		0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+		0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee };
+	uint8_t ctr_buf[64];
+	memcpy(ctr_buf, ctr_plain, 64);
+	aes.ctr(ctr_buf, 64, ctr_iv);
+	if (memcmp(ctr_buf, ctr_cipher, 64) != 0) printf("AES-128 CTR error\n");
+	memcpy(ctr_buf, ctr_plain, 64);
+	for (int i = 0; i < 4; i++) aes.ctr(ctr_buf + i * 16, 16, ctr_iv, i);
+	if (memcmp(ctr_buf, ctr_cipher, 64) != 0) printf("AES-128 CTR block error\n");
+
+	// CBC четырех буферов сразу должно совпадать с четырьмя вызовами cbc_encrypt()
+	uint8_t cbc_one[4][64], cbc_four[4][64];
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 64; j++) cbc_one[i][j] = (uint8_t)(ctr_plain[j] + i * 0x35);
+		memcpy(cbc_four[i], cbc_one[i], 64);
+		aes.cbc_encrypt(cbc_one[i], 64);
+	}
+	void* cbc_list[4] = { cbc_four[0], cbc_four[1], cbc_four[2], cbc_four[3] };
+	aes.cbc_encrypt4(cbc_list, 64);
+	if (memcmp(cbc_one, cbc_four, sizeof(cbc_one)) != 0) printf("AES-128 CBC x4 error\n");
 }
 #endif
\ No newline at end of file
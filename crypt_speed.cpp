@@ -3,8 +3,13 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <time.h>
+#include <tuple>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
 
 //#define LT_STAT
+//#define TEST_AFFINITY LT_AFFINITY_COMPACT // Привязка потоков к процессорам
 #include "lite_thread.h"
 #include "cbc.h"
 #include "rc4.h"
@@ -18,6 +23,12 @@
 #define MSG_COUNT 1000000
 #endif
 #define MSG_USE 256
+#define LOCK_COUNT (MSG_COUNT * 4)
+
+// Время в мс с дробной частью для вывода замера
+static double time_ms(int64_t time_ns) {
+	return (double)time_ns / 1000000;
+}
 
 // Сообщение
 class msg_t : public lite_msg_t {
@@ -41,12 +52,14 @@ public:
 
 // Базовый класс для остальных замеров
 class base_actor_t : public lite_actor_t {
-	lite_actor_t* next; // следующий обработчик
-
 	void recv(lite_msg_t* msg) override {
 		msg_t* m = work(static_cast<msg_t*>(msg));
 		if(m != NULL) next->run(m);
 	}
+
+protected:
+	lite_actor_t* next; // следующий обработчик
+
 public:
 	base_actor_t() : next(NULL) {
 	}
@@ -62,11 +75,45 @@ public:
 
 };
 
+// Актор из одной стадии обработки. Стадия - класс с невиртуальной функцией msg_t* work(msg_t*)
+template <typename Stage>
+class stage_actor_t : public base_actor_t {
+	Stage stage;
+
+	msg_t* work(msg_t* msg) override {
+		return stage.work(msg);
+	}
+};
+
+// Конвейер стадий, объединенных при компиляции в один актор. Вызовы стадий без виртуальных
+// функций, компилятор может встроить их друг в друга. Однопоточный конвейер выполняет стадии одну за
+// другой, а цепочка акторов - одновременно в разных потоках, поэтому конвейер дополнительно замеряется
+// параллельным: стадии не зависят от соседних сообщений
+template <typename... Stages>
+class pipeline_t : public base_actor_t {
+	std::tuple<Stages...> stages;
+
+	template <size_t I>
+	typename std::enable_if<I == sizeof...(Stages), msg_t*>::type work_from(msg_t* msg) {
+		return msg;
+	}
+
+	template <size_t I>
+	typename std::enable_if<I < sizeof...(Stages), msg_t*>::type work_from(msg_t* msg) {
+		msg = std::get<I>(stages).work(msg);
+		return msg == NULL ? NULL : work_from<I + 1>(msg);
+	}
+
+	msg_t* work(msg_t* msg) override {
+		return work_from<0>(msg);
+	}
+};
+
 // Подготовка сообщений, запуск на шифрование, замер времени и подсчет результатов
 class sender_t : public lite_actor_t {
 	lite_actor_t* next = NULL; // следующий обработчик
 	uint32_t msg_count; // Счетчик количества отправляемых сообщений
-	int time_start;
+	int64_t time_start;
 
 	// Обработчик сообщений
 	void recv(lite_msg_t* msg) override {
@@ -75,10 +122,10 @@ class sender_t : public lite_actor_t {
 			return;
 		case 1: // Пришло последнее сообщение
 			msg_count--;
-			int time = (int)lite_time_now() - time_start;
+			int64_t time = lite_time_ns() - time_start;
 			if (time == 0) time = 1;
 			int64_t total = (int64_t)MSG_SIZE * MSG_COUNT;
-			lite_log(0, "%d ms %d Mb/s", time, (int)((total * 1000 / time) >> 20));
+			lite_log(0, "%.3f ms %d Mb/s", time_ms(time), (int)((total * 1000000000 / time) >> 20));
 			return;
 		}
 		msg_count--;
@@ -89,20 +136,479 @@ public:
 	sender_t(lite_actor_t* next) {
 		this->next = next;
 		this->msg_count = MSG_COUNT;
-		this->time_start = (int)lite_time_now();
+		this->time_start = lite_time_ns();
 		type_add(lite_msg_type<msg_t>());
 	}
 };
 
-// Запуск теста 
-void test(const char* descr, base_actor_t* ba) {
+// Запуск теста цепочки акторов, каждое сообщение проходит их по порядку
+void test_chain(const char* descr, const std::vector<base_actor_t*>& chain) {
+	sender_t* s = new sender_t(chain.front()); // Генератор сообщений
+	for (size_t i = 0; i + 1 < chain.size(); i++) chain[i]->next_set(chain[i + 1]);
+	chain.back()->next_set(s);
+	lite_log(0, "test speed %s %d blocks of %d bytes each ...", descr, MSG_COUNT, MSG_SIZE);
+	for (size_t i = 0; i != MSG_USE; i++) s->run(new msg_t); // Запуск MSG_USE сообщений
+	lite_thread_end(); // Ожидание завершения
+}
+
+// Запуск теста, fuse - прямой вызов следующего в цепочке
+void test(const char* descr, base_actor_t* ba, bool fuse = false) {
 	sender_t* s = new sender_t(ba); // Генератор сообщений
 	ba->next_set(s);
+	s->fuse_set(fuse);
+	ba->fuse_set(fuse);
 	lite_log(0, "test speed %s %d blocks of %d bytes each ...", descr, MSG_COUNT, MSG_SIZE);
 	for (size_t i = 0; i != MSG_USE; i++) s->run(new msg_t); // Запуск MSG_USE сообщений
 	lite_thread_end(); // Ожидание завершения
 }
 
+// Запуск теста конвейера стадий, выполняемого одновременно в threads потоках, отдельно от сравнения
+// с цепочкой акторов в тех же условиях. Результат передается
+// генератору прямым вызовом: иначе каждое сообщение будит еще один поток, что сравнимо по времени с самими стадиями
+template <typename... Stages>
+void test_pipeline(const char* descr, int threads) {
+	pipeline_t<Stages...>* p = new pipeline_t<Stages...>();
+	p->parallel_set(threads);
+	test(descr, p, true);
+}
+
+// Общие данные набора акторов relay_t
+struct relay_info_t {
+	std::vector<lite_actor_t*> list;	// Набор акторов
+	std::atomic<int64_t> msg_count;		// Оставшееся количество пересылок
+	int64_t time_start;
+};
+
+// Пересылка сообщения случайному актору из набора, используется для замера скорости планировщика
+class relay_t : public lite_actor_t {
+	relay_info_t* info;
+
+	void recv(lite_msg_t* msg) override {
+		int64_t n = info->msg_count--;
+		if (n <= 0) return;
+		if (n == 1) { // Последняя пересылка
+			int64_t time = lite_time_ns() - info->time_start;
+			if (time == 0) time = 1;
+			lite_log(0, "%.3f ms %d msg/s", time_ms(time), (int)((int64_t)MSG_COUNT * 1000000000 / time));
+			return;
+		}
+		msg_t* m = static_cast<msg_t*>(msg);
+		uint32_t state;
+		memcpy(&state, m->data, sizeof(state));
+		state = state * 1103515245 + 12345;
+		memcpy(m->data, &state, sizeof(state));
+		info->list[(state >> 8) % info->list.size()]->run(m);
+	}
+
+public:
+	relay_t(relay_info_t* info) : info(info) {
+		type_add(lite_msg_type<msg_t>());
+	}
+};
+
+// Запуск теста пересылки между count акторами, res_max - ограничение ресурса акторов
+void test_relay(size_t count, int res_max = 0) {
+	relay_info_t info;
+	info.msg_count = MSG_COUNT;
+	lite_resource_t* res = (res_max > 0 ? lite_resource_create("relay", res_max) : NULL);
+	for (size_t i = 0; i != count; i++) {
+		info.list.push_back(new relay_t(&info));
+		if (res != NULL) info.list.back()->resource_set(res);
+	}
+	lite_log(0, "test speed send to random of %d actors %d messages (resource %d) ...", (int)count, MSG_COUNT, res_max);
+	info.time_start = lite_time_ns();
+	for (size_t i = 0; i != MSG_USE; i++) info.list[i % count]->run(new msg_t);
+	lite_thread_end(); // Ожидание завершения
+}
+
+#define RING_SIZE 16		// Акторов в кольце теста lite_thread_wait_idle()
+#define RING_ROUNDS 20		// Количество ожиданий
+#define RING_MSG 64			// Сообщений за раунд
+#define RING_HOPS 100		// Пересылок каждого сообщения
+
+// Сообщение с количеством оставшихся пересылок по кольцу
+struct hop_t : public lite_msg_t {
+	int hops;
+};
+
+// Пересылка сообщения следующему в кольце, по окончании пересылок учет в done
+class ring_t : public lite_actor_t {
+	std::atomic<int>* done;
+
+	void recv(lite_msg_t* msg) override {
+		hop_t* m = static_cast<hop_t*>(msg);
+		if (--m->hops > 0) {
+			next->run(m);
+		} else {
+			(*done)++;
+		}
+	}
+
+public:
+	lite_actor_t* next = NULL;
+
+	ring_t(std::atomic<int>* done) : done(done) {
+		type_add(lite_msg_type<hop_t>());
+	}
+};
+
+// Ожидание завершения обработки раунда сообщений без остановки потоков и удаления акторов
+void test_wait_idle() {
+	std::atomic<int> done(0);
+	std::vector<ring_t*> ring;
+	for (size_t i = 0; i != RING_SIZE; i++) ring.push_back(new ring_t(&done));
+	for (size_t i = 0; i != RING_SIZE; i++) ring[i]->next = ring[(i + 1) % RING_SIZE];
+	lite_log(0, "test wait_idle ring of %d actors %d rounds of %d messages ...", RING_SIZE, RING_ROUNDS, RING_MSG);
+	int64_t time_start = lite_time_ns();
+	int incomplete = 0; // Раундов, после ожидания которых остались необработанные сообщения
+	for (int r = 1; r <= RING_ROUNDS; r++) {
+		for (int i = 0; i != RING_MSG; i++) {
+			hop_t* m = new hop_t;
+			m->hops = RING_HOPS;
+			ring[i % RING_SIZE]->run(m);
+		}
+		lite_thread_wait_idle();
+		if (done != r * RING_MSG) incomplete++;
+	}
+	int64_t time_end = lite_time_ns();
+	lite_thread_end(); // Ожидание завершения
+	lite_log(0, "%.3f ms incomplete rounds %d, end %.3f ms", time_ms(time_end - time_start), incomplete, time_ms(lite_time_ns() - time_end));
+}
+
+// Короткое сообщение без данных
+struct tick_t : public lite_msg_t {
+};
+
+#define FAN_BATCH 64	// Размер пачки отправляемой источником
+#define FAN_STEP 1024	// Сколько сообщений источник отправляет за один запуск
+
+// Приемник сообщений от нескольких источников
+class fan_in_t : public lite_actor_t {
+	int64_t msg_count;
+	int64_t time_start;
+
+	void recv(lite_msg_t*) override {
+		if (--msg_count != 0) return;
+		int64_t time = lite_time_ns() - time_start;
+		if (time == 0) time = 1;
+		lite_log(0, "%.3f ms %d msg/s", time_ms(time), (int)((int64_t)MSG_COUNT * 1000000000 / time));
+	}
+
+public:
+	fan_in_t(int64_t count) : msg_count(count), time_start(lite_time_ns()) {
+	}
+};
+
+// Источник, отправляет приемнику count сообщений пачками по batch
+class fan_src_t : public lite_actor_t {
+	lite_actor_t* dst;
+	size_t count;
+	size_t batch;
+
+	void recv(lite_msg_t* msg) override {
+		tick_t* list[FAN_BATCH];
+		for (size_t step = 0; step < FAN_STEP && count != 0; ) {
+			size_t n = std::min(batch, count);
+			for (size_t i = 0; i != n; i++) list[i] = new tick_t;
+			if (n == 1) {
+				dst->run(list[0]);
+			} else {
+				dst->run_batch(list, n);
+			}
+			count -= n;
+			step += n;
+		}
+		if (count != 0) run(msg); // Продолжение при следующем запуске
+	}
+
+public:
+	fan_src_t(lite_actor_t* dst, size_t count, size_t batch) : dst(dst), count(count), batch(std::min(batch, (size_t)FAN_BATCH)) {
+	}
+};
+
+// Запуск теста отправки одному актору от src_count источников пачками по batch сообщений
+void test_fan_in(size_t src_count, size_t batch) {
+	size_t count = MSG_COUNT / src_count;
+	lite_log(0, "test speed fan-in %d sources %d messages (batch %d) ...", (int)src_count, (int)(count * src_count), (int)batch);
+	fan_in_t* dst = new fan_in_t(count * src_count);
+	for (size_t i = 0; i != src_count; i++) (new fan_src_t(dst, count, batch))->run(new tick_t);
+	lite_thread_end(); // Ожидание завершения
+}
+
+// Актор с периодическим таймером, после fire_max срабатываний отключает таймер
+class timer_actor_t : public lite_actor_t {
+	std::atomic<int>* active;	// Количество акторов с включенным таймером
+	int fire_count;
+	int fire_max;
+
+	void recv(lite_msg_t*) override {
+	}
+
+	void timer() override {
+		if (++fire_count != fire_max) return;
+		timer_set(0);
+		(*active)--;
+	}
+
+public:
+	timer_actor_t(std::atomic<int>* active, int fire_max) : active(active), fire_count(0), fire_max(fire_max) {
+	}
+};
+
+// Запуск теста count таймеров с периодом period_us, по fire_max срабатываний каждый
+void test_timer(size_t count, int period_us, int fire_max, int mode) {
+	lite_log(0, "test timer %d actors every %d us %d times (%s) ...", (int)count, period_us, fire_max, mode == LT_TIMER_WORKER ? "worker" : "thread");
+	lite_timer_mode(mode);
+	std::atomic<int> active(0);
+	int64_t time_start = lite_time_ns();
+	for (size_t i = 0; i != count; i++) {
+		active++;
+		(new timer_actor_t(&active, fire_max))->timer_set_us(period_us);
+	}
+	while (active != 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	lite_log(0, "%.3f ms (ideal %d ms)", time_ms(lite_time_ns() - time_start), period_us * fire_max / 1000);
+	lite_thread_end(); // Ожидание завершения
+}
+
+#define PRIO_BULK 200000	// Количество фоновых сообщений в тесте приоритетов
+#define PRIO_STEP 1000		// Через сколько фоновых сообщений отправляется управляющее
+
+// Управляющее сообщение, время отправки для замера задержки
+struct ctrl_t : public lite_msg_t {
+	int64_t time_send;
+};
+
+// Обработчик фоновых и управляющих сообщений, замеряет задержку управляющих
+class prio_worker_t : public lite_actor_t {
+	size_t msg_count;
+	size_t ctrl_count;
+	int64_t ctrl_sum;
+	int64_t ctrl_max;
+	uint64_t x;
+
+	void recv(lite_msg_t* msg) override {
+		ctrl_t* ctrl = dynamic_cast<ctrl_t*>(msg);
+		if (ctrl != NULL) {
+			int64_t t = lite_time_ns() - ctrl->time_send;
+			ctrl_sum += t;
+			if (t > ctrl_max) ctrl_max = t;
+			ctrl_count++;
+		} else {
+			for (int i = 0; i != 64; i++) { // Имитация работы
+				x ^= x << 13;
+				x ^= x >> 7;
+				x ^= x << 17;
+			}
+		}
+		if (--msg_count != 0) return;
+		lite_log(0, "control latency avg %.3f ms max %.3f ms (%d)", time_ms(ctrl_sum / (ctrl_count ? ctrl_count : 1)), time_ms(ctrl_max), (int)(x & 1));
+	}
+
+public:
+	prio_worker_t(size_t count) : msg_count(count), ctrl_count(0), ctrl_sum(0), ctrl_max(0), x(1) {
+		type_add(lite_msg_type<tick_t>());
+		type_add(lite_msg_type<ctrl_t>());
+	}
+};
+
+// Запуск теста задержки управляющих сообщений с приоритетом prio на фоне потока фоновых сообщений
+void test_priority(int prio) {
+	lite_log(0, "test priority control messages %s among %d bulk ...", prio == LT_PRIO_HIGH ? "high" : "normal", PRIO_BULK);
+	prio_worker_t* worker = new prio_worker_t(PRIO_BULK + PRIO_BULK / PRIO_STEP);
+	tick_t* list[FAN_BATCH];
+	for (size_t i = 0; i != PRIO_BULK; i += FAN_BATCH) {
+		for (size_t j = 0; j != FAN_BATCH; j++) list[j] = new tick_t;
+		worker->run_batch(list, FAN_BATCH);
+		if ((i + FAN_BATCH) % PRIO_STEP < FAN_BATCH) {
+			ctrl_t* ctrl = new ctrl_t;
+			ctrl->time_send = lite_time_ns();
+			worker->run(ctrl, prio);
+		}
+	}
+	lite_thread_end(); // Ожидание завершения
+}
+
+#define FAN_OUT_COUNT 200000	// Количество рассылаемых сообщений в тесте рассылки
+
+// Общие данные теста рассылки
+struct fan_out_info_t {
+	std::atomic<int64_t> msg_count;	// Оставшееся количество обработок
+	int64_t time_start;
+	uint64_t sum;					// Контрольная сумма, чтобы чтение не было выброшено компилятором
+	lite_credit_t credit;			// Ограничение количества сообщений в обработке
+
+	fan_out_info_t(size_t sub_count) : msg_count((int64_t)FAN_OUT_COUNT * sub_count), time_start(lite_time_ns()), sum(0), credit(MSG_USE * sub_count) {
+	}
+};
+
+// Подписчик, читает сообщение
+class fan_sub_t : public lite_actor_t {
+	fan_out_info_t* info;
+	uint64_t sum;
+
+	void recv(lite_msg_t* msg) override {
+		const msg_t* m = static_cast<const msg_t*>(msg);
+		const uint64_t* d = (const uint64_t*)m->data;
+		for (size_t i = 0; i != MSG_SIZE / sizeof(uint64_t); i++) sum += d[i];
+		info->credit.give();
+		if (--info->msg_count != 0) return;
+		int64_t time = lite_time_ns() - info->time_start;
+		if (time == 0) time = 1;
+		info->sum = sum;
+		lite_log(0, "%.3f ms %d msg/s", time_ms(time), (int)((int64_t)FAN_OUT_COUNT * 1000000000 / time));
+	}
+
+public:
+	fan_sub_t(fan_out_info_t* info) : info(info), sum(0) {
+		type_add(lite_msg_type<msg_t>());
+	}
+};
+
+// Источник, рассылает каждое сообщение всем подписчикам копиями или общим сообщением
+class fan_out_t : public lite_actor_t {
+	fan_out_info_t* info;
+	std::vector<lite_actor_t*> subs;
+	size_t count;
+	bool share;
+	msg_t proto; // Образец данных, заполнение каждого сообщения генератором дороже рассылки
+
+	// Отправка очередной порции, false - завершено или ожидание кредитов
+	bool send() {
+		for (size_t step = 0; step < FAN_STEP && count != 0; step++, count--) {
+			if (!info->credit.take(this, subs.size())) return false; // Продолжение в timer()
+			msg_t* m = new msg_t(proto);
+			if (share) {
+				lite_msg_share(m, subs);
+			} else {
+				for (size_t i = 1; i < subs.size(); i++) subs[i]->run(lite_msg_copy(m));
+				subs[0]->run(m);
+			}
+		}
+		return count != 0;
+	}
+
+	void recv(lite_msg_t* msg) override {
+		if (send()) run(msg); // Продолжение при следующем запуске
+	}
+
+	void timer() override {
+		if (send()) run(new tick_t);
+	}
+
+public:
+	fan_out_t(fan_out_info_t* info, const std::vector<lite_actor_t*>& subs, bool share) : info(info), subs(subs), count(FAN_OUT_COUNT), share(share) {
+	}
+};
+
+// Запуск теста рассылки каждого сообщения sub_count подписчикам
+void test_fan_out(size_t sub_count, bool share) {
+	lite_log(0, "test fan-out %d messages to %d subscribers (%s) ...", FAN_OUT_COUNT, (int)sub_count, share ? "shared" : "copy");
+	fan_out_info_t info(sub_count);
+	std::vector<lite_actor_t*> subs;
+	for (size_t i = 0; i != sub_count; i++) subs.push_back(new fan_sub_t(&info));
+	(new fan_out_t(&info, subs, share))->run(new tick_t);
+	lite_thread_end(); // Ожидание завершения
+}
+
+#define OVER_COUNT 200000	// Количество сообщений в тесте перегрузки
+#define OVER_LIMIT 256		// Ограничение очереди / количество кредитов
+#define OVER_NONE 0			// Без ограничения
+#define OVER_CAPACITY 1		// Ограничение очереди, try_run() с отбрасыванием при отказе
+#define OVER_CREDIT 2		// Кредиты между отправителем и получателем
+
+// Общие счетчики теста перегрузки
+struct over_info_t {
+	std::atomic<int64_t> sent;	// Принято получателем в очередь
+	int64_t done;				// Обработано получателем
+	int64_t rejected;			// Отказов при отправке
+	int64_t queue_max;			// Максимум сообщений в очереди
+	lite_credit_t credit;
+	int64_t time_start;
+	int64_t time_end;			// Время обработки последнего сообщения
+
+	over_info_t() : sent(0), done(0), rejected(0), queue_max(0), credit(OVER_LIMIT), time_start(lite_time_ns()), time_end(0) {
+	}
+};
+
+// Медленный получатель
+class over_dst_t : public lite_actor_t {
+	over_info_t* info;
+	int mode;
+	uint64_t x;
+
+	void recv(lite_msg_t*) override {
+		for (int i = 0; i != 256; i++) { // Имитация работы
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+		}
+		int64_t queue = info->sent - info->done;
+		if (queue > info->queue_max) info->queue_max = queue;
+		info->done++;
+		info->time_end = lite_time_ns() + (x & 1);
+		if (mode == OVER_CREDIT) info->credit.give();
+	}
+
+public:
+	over_dst_t(over_info_t* info, int mode) : info(info), mode(mode), x(1) {
+		if (mode == OVER_CAPACITY) capacity_set(OVER_LIMIT);
+	}
+};
+
+// Быстрый отправитель
+class over_src_t : public lite_actor_t {
+	over_info_t* info;
+	over_dst_t* dst;
+	int mode;
+	int64_t count;
+
+	// Отправка очередной порции, false - ожидание кредитов
+	bool send() {
+		for (size_t step = 0; step < FAN_STEP && count != 0; step++) {
+			if (mode == OVER_CREDIT && !info->credit.take(this)) return false; // Продолжение в timer()
+			tick_t* msg = new tick_t;
+			count--;
+			if (mode == OVER_CAPACITY) {
+				info->sent++;
+				if (!dst->try_run(msg)) {
+					info->sent--;
+					delete msg;
+					info->rejected++;
+				}
+			} else {
+				info->sent++;
+				dst->run(msg);
+			}
+		}
+		return count != 0;
+	}
+
+	void recv(lite_msg_t* msg) override {
+		if (send()) run(msg);
+	}
+
+	void timer() override {
+		if (send()) run(new tick_t);
+	}
+
+public:
+	over_src_t(over_info_t* info, over_dst_t* dst, int mode) : info(info), dst(dst), mode(mode), count(OVER_COUNT) {
+	}
+};
+
+// Запуск теста перегрузки медленного получателя быстрым отправителем
+void test_overload(int mode) {
+	lite_log(0, "test overload %d messages (%s) ...", OVER_COUNT, mode == OVER_NONE ? "unbounded" : mode == OVER_CAPACITY ? "capacity + try_run" : "credit");
+	over_info_t info;
+	over_dst_t* dst = new over_dst_t(&info, mode);
+	(new over_src_t(&info, dst, mode))->run(new tick_t);
+	lite_thread_end(); // Ожидание завершения
+	int64_t time = info.time_end - info.time_start;
+	if (time == 0) time = 1;
+	lite_log(0, "%.3f ms done %d msg/s rejected %d queue max %d", time_ms(time), (int)(info.done * 1000000000 / time),
+		(int)info.rejected, (int)info.queue_max);
+}
+
 // Пересылка далее, используется для замера скорости пересылки
 class empty_t : public base_actor_t {
 	msg_t* work(msg_t* msg) override {
@@ -110,29 +616,82 @@ class empty_t : public base_actor_t {
 	}
 };
 
-// Шифрование XOR сдвинутым ключом
-class xor_shift_t : public base_actor_t {
-	uint8_t key[MSG_SIZE + 256];
+// Стадия шифрования XOR сдвинутым ключом
+class xor_shift_stage_t {
+	alignas(8) uint8_t key[MSG_SIZE + 256]; // Читается по 8 байт, в конвейере стадия может лежать после 4-байтовой
 
-	msg_t* work(msg_t* msg) override {
+public:
+	msg_t* work(msg_t* msg) {
 		uint64_t *k = (uint64_t *)(key + (msg->data[0] & 0xF8)), *d = (uint64_t *)(msg->data); // Начало последовательности для шифрования текущего блока
 		msg->data[0] ^= k[0]; // buf[0] нельзя шифровать, а если цикл начать с 1 почему-то медленнее работает
 		for (size_t i = 0; i != MSG_SIZE / sizeof(uint64_t); i++) d[i] ^= k[i]; // Шифрование
 		return msg;
 	}
 
-public:
 	void init_key(const void* password, size_t pass_size) {
 		md5_t md5;
 		rc4_t rc4(md5.calc(password, pass_size), 16); // Инициализация ключевой последовательности
 		rc4.crypt(key, sizeof(key)); // Заполнение ключевой последовательности
 	}
 
-	xor_shift_t() {
+	xor_shift_stage_t() {
 		init_key("My secret key", 13);
 	}
 };
 
+// Шифрование XOR сдвинутым ключом
+class xor_shift_t : public stage_actor_t<xor_shift_stage_t> {
+};
+
+// Стадия подсчета CRC32 сообщения (по 8 байт, slicing-by-8), накапливается в crc
+class crc32_stage_t {
+	typedef uint32_t table_t[8][256];
+	std::atomic<uint32_t> crc; // Атомарно для параллельного конвейера
+
+	// Общие для всех таблицы
+	static const table_t& table_get() {
+		static table_t table;
+		static bool ready = false;
+		if (!ready) {
+			for (uint32_t i = 0; i != 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k != 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				table[0][i] = c;
+			}
+			for (uint32_t i = 0; i != 256; i++) {
+				for (int k = 1; k != 8; k++) table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xFF];
+			}
+			ready = true;
+		}
+		return table;
+	}
+
+public:
+	msg_t* work(msg_t* msg) {
+		static const table_t& table = table_get();
+		uint32_t c = 0xFFFFFFFF;
+		const uint8_t* p = msg->data;
+		for (size_t i = 0; i != MSG_SIZE / 8; i++, p += 8) {
+			uint32_t lo, hi;
+			memcpy(&lo, p, 4);
+			memcpy(&hi, p + 4, 4);
+			lo ^= c;
+			c = table[7][lo & 0xFF] ^ table[6][(lo >> 8) & 0xFF] ^ table[5][(lo >> 16) & 0xFF] ^ table[4][lo >> 24] ^
+				table[3][hi & 0xFF] ^ table[2][(hi >> 8) & 0xFF] ^ table[1][(hi >> 16) & 0xFF] ^ table[0][hi >> 24];
+		}
+		crc.fetch_xor(~c, std::memory_order_relaxed);
+		return msg;
+	}
+
+	crc32_stage_t() : crc(0) {
+		table_get();
+	}
+};
+
+// Подсчет CRC32
+class crc32_t : public stage_actor_t<crc32_stage_t> {
+};
+
 // Шифрование CBC + XOR сдвинутым ключом
 class cbc_xor_encrypt_t : public base_actor_t {
 	uint8_t key[MSG_SIZE + 256];
@@ -180,21 +739,25 @@ public:
 	}
 };
 
-// Шифрование AES-128
-class aes_encrypt_t : public base_actor_t {
+// Стадия шифрования AES-128
+class aes_encrypt_stage_t {
 	aes128ni_t aes;
 
-	msg_t* work(msg_t* msg) override {
+public:
+	msg_t* work(msg_t* msg) {
 		aes.encrypt(msg->data, MSG_SIZE);
 		return msg;
 	}
 
-public:
-	aes_encrypt_t() {
+	aes_encrypt_stage_t() {
 		aes.init("My secret key...");
 	}
 };
 
+// Шифрование AES-128
+class aes_encrypt_t : public stage_actor_t<aes_encrypt_stage_t> {
+};
+
 // Расшифровка AES-128
 class aes_decrypt_t : public base_actor_t {
 	aes128ni_t aes;
@@ -225,6 +788,33 @@ public:
 	}
 };
 
+// Шифрование AES-128 + CBC по 4 сообщения за раз
+class aes_cbc_encrypt4_t : public base_actor_t {
+	aes128ni_t aes;
+
+	msg_t* work(msg_t* msg) override {
+		aes.cbc_encrypt(msg->data, sizeof(msg->data));
+		return msg;
+	}
+
+	void recv_batch(lite_msg_t** msgs, size_t n) override {
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4) {
+			void* buf[4];
+			for (size_t k = 0; k != 4; k++) buf[k] = static_cast<msg_t*>(msgs[i + k])->data;
+			aes.cbc_encrypt4(buf, MSG_SIZE);
+			for (size_t k = 0; k != 4; k++) next->run(static_cast<msg_t*>(msgs[i + k]));
+		}
+		if (i != n) lite_actor_t::recv_batch(msgs + i, n - i); // Остаток по одному
+	}
+
+public:
+	aes_cbc_encrypt4_t() {
+		aes.init("My secret key...");
+		batch_set(4);
+	}
+};
+
 // Расшифровка AES-128 + CBC
 class aes_cbc_decrypt_t : public base_actor_t {
 	aes128ni_t aes;
@@ -271,13 +861,338 @@ public:
 	}
 };
 
+// Датаграмма потока с номером для проверки порядка на выходе
+struct dgram_t : public msg_t {
+	uint32_t seq;
+};
+
+// Шифрование AES-128 + CBC датаграмм одного потока в threads потоках. ordered - порядок
+// восстанавливает актор (order_set), иначе датаграмма отправляется дальше сразу после шифрования
+class aes_cbc_flow_t : public lite_actor_t {
+	aes128ni_t aes;
+	lite_actor_t* next;
+	bool ordered;
+
+	void recv(lite_msg_t* msg) override {
+		aes.cbc_encrypt(static_cast<dgram_t*>(msg)->data, MSG_SIZE);
+		if (!ordered) next->run(msg);
+	}
+
+public:
+	aes_cbc_flow_t(lite_actor_t* next, int threads, bool ordered) : next(next), ordered(ordered) {
+		aes.init("My secret key...");
+		parallel_set(threads);
+		if (ordered) order_set(next);
+	}
+};
+
+// Получатель потока: проверка порядка, подсчет и отправка датаграмм на шифрование по кругу
+class flow_sink_t : public lite_actor_t {
+	uint32_t send_seq;	// Номер следующей отправляемой
+	uint32_t recv_seq;	// Ожидаемый номер следующей полученной
+	uint32_t count;		// Получено датаграмм
+	uint32_t disorder;	// Получено не по порядку
+	int64_t time_start;
 
+	void recv(lite_msg_t* msg) override {
+		dgram_t* m = static_cast<dgram_t*>(msg);
+		if (m->seq != recv_seq) disorder++;
+		recv_seq = m->seq + 1;
+		if (++count == MSG_COUNT) {
+			int64_t time = lite_time_ns() - time_start;
+			if (time == 0) time = 1;
+			int64_t total = (int64_t)MSG_SIZE * MSG_COUNT;
+			lite_log(0, "%.3f ms %d Mb/s, out of order %u", time_ms(time), (int)((total * 1000000000 / time) >> 20), disorder);
+			return;
+		}
+		if (send_seq < MSG_COUNT) {
+			m->seq = send_seq++;
+			flow->run(m);
+		}
+	}
+
+public:
+	lite_actor_t* flow = NULL; // Шифрование
+
+	flow_sink_t() : send_seq(MSG_USE), recv_seq(0), count(0), disorder(0), time_start(lite_time_ns()) {
+	}
+};
+
+// Шифрование одного потока датаграмм в threads потоках с сохранением порядка (ordered) или без
+void test_flow(int threads, bool ordered) {
+	flow_sink_t* sink = new flow_sink_t();
+	sink->flow = new aes_cbc_flow_t(sink, threads, ordered);
+	lite_log(0, "test speed AES-128 + CBC flow %d threads%s %d blocks of %d bytes each ...", threads, ordered ? " ordered" : "", MSG_COUNT, MSG_SIZE);
+	dgram_t* msgs[MSG_USE];
+	for (uint32_t i = 0; i != MSG_USE; i++) {
+		msgs[i] = new dgram_t;
+		msgs[i]->seq = i;
+	}
+	sink->flow->run_batch(msgs, MSG_USE); // Одной пачкой, чтобы номера шли в очереди по порядку
+	lite_thread_end(); // Ожидание завершения
+}
+
+#define SHARD_FLOWS 4096				// Количество потоков данных в тесте разделения по ключу
+#define SHARD_MSG_COUNT (MSG_COUNT / 4)	// Количество датаграмм в тесте разделения по ключу
+#define FLOW_NONE UINT32_MAX			// Датаграмма еще не отправлялась
+
+// Датаграмма потока данных flow
+struct flow_dgram_t : public dgram_t {
+	uint32_t flow = FLOW_NONE;
+};
+
+// Часть раздела: шифрование AES-128 + CBC датаграмм своих потоков с проверкой порядка в каждом
+class flow_shard_t : public lite_actor_t {
+	aes128ni_t aes;
+	lite_actor_t* src;
+	std::unordered_map<uint32_t, uint32_t> recv_seq; // Ожидаемый номер следующей датаграммы по потоку
+
+	void recv(lite_msg_t* msg) override {
+		flow_dgram_t* m = static_cast<flow_dgram_t*>(msg);
+		uint32_t& seq = recv_seq[m->flow];
+		if (m->seq != seq) disorder++;
+		seq = m->seq + 1;
+		aes.cbc_encrypt(m->data, MSG_SIZE);
+		count++;
+		src->run(m);
+	}
+
+public:
+	size_t count = 0;		// Обработано датаграмм
+	size_t disorder = 0;	// Получено не по порядку внутри потока
+
+	flow_shard_t(lite_actor_t* src) : src(src) {
+		aes.init("My secret key...");
+	}
+};
+
+// Источник датаграмм: потоки выбираются по распределению Зипфа с параметром s (0 - равномерно)
+class flow_src_t : public lite_actor_t {
+	std::vector<double> cdf;			// Функция распределения по номерам потоков
+	std::vector<uint32_t> send_seq;		// Номер следующей датаграммы по потоку
+	uint32_t rnd = 2463534242U;			// Состояние генератора xorshift
+	size_t sent = 0;
+	size_t done = 0;
+	int64_t time_start;
+
+	uint32_t flow_next() {
+		rnd ^= rnd << 13;
+		rnd ^= rnd >> 17;
+		rnd ^= rnd << 5;
+		double u = (double)rnd / 4294967296.0;
+		return (uint32_t)(std::upper_bound(cdf.begin(), cdf.end() - 1, u) - cdf.begin());
+	}
+
+	void recv(lite_msg_t* msg) override {
+		flow_dgram_t* m = static_cast<flow_dgram_t*>(msg);
+		if (m->flow != FLOW_NONE && ++done == SHARD_MSG_COUNT) {
+			int64_t time = lite_time_ns() - time_start;
+			if (time == 0) time = 1;
+			int64_t total = (int64_t)MSG_SIZE * SHARD_MSG_COUNT;
+			size_t disorder = 0, busiest = 0;
+			for (size_t i = 0; i < shards->size(); i++) {
+				disorder += shards->shard(i)->disorder;
+				busiest = std::max(busiest, shards->shard(i)->count);
+			}
+			lite_log(0, "%.3f ms %d Mb/s, busiest shard %.1f%%, out of order %u", time_ms(time), (int)((total * 1000000000 / time) >> 20),
+				100.0 * busiest / SHARD_MSG_COUNT, (uint32_t)disorder);
+			return;
+		}
+		if (sent == SHARD_MSG_COUNT) return;
+		sent++;
+		m->flow = flow_next();
+		m->seq = send_seq[m->flow]++;
+		shards->run(m, m->flow);
+	}
+
+public:
+	lite_shard_t<flow_shard_t>* shards = NULL;
+
+	flow_src_t(double s) : cdf(SHARD_FLOWS), send_seq(SHARD_FLOWS, 0), time_start(lite_time_ns()) {
+		double sum = 0;
+		for (size_t i = 0; i < SHARD_FLOWS; i++) cdf[i] = (sum += 1.0 / std::pow((double)(i + 1), s));
+		for (size_t i = 0; i < SHARD_FLOWS; i++) cdf[i] /= sum;
+	}
+};
+
+// Шифрование SHARD_FLOWS потоков датаграмм, разделенных по номеру потока на shard_count частей
+void test_shard(size_t shard_count, double zipf_s) {
+	flow_src_t* src = new flow_src_t(zipf_s);
+	lite_shard_t<flow_shard_t> shards(shard_count, src);
+	src->shards = &shards;
+	lite_log(0, "test speed AES-128 + CBC %d flows (zipf %.1f) on %d shards %d blocks of %d bytes each ...",
+		SHARD_FLOWS, zipf_s, (int)shard_count, SHARD_MSG_COUNT, MSG_SIZE);
+	for (size_t i = 0; i != MSG_USE; i++) src->run(new flow_dgram_t);
+	lite_thread_end(); // Ожидание завершения
+}
+
+#ifdef _DEBUG
+#define BULK_SIZE (1 << 20)		// Размер буфера в тесте шифрования большого буфера
+#else
+#define BULK_SIZE (256 << 20)
+#endif
+#define BULK_GRAIN 0x4000		// Часть параллельного цикла, блоков по 16 байт
+
+// Замер обработки буфера блоками [b, e) по 16 байт одним вызовом fn или параллельным циклом
+static void bulk_run(const char* descr, bool parallel, const std::function<void(size_t, size_t)>& fn) {
+	lite_log(0, "test speed %s%s %d MiB ...", descr, parallel ? " parallel_for" : "", BULK_SIZE >> 20);
+	int64_t time_start = lite_time_ns();
+	if (parallel) {
+		lite_parallel_for(0, BULK_SIZE / 16, BULK_GRAIN, fn);
+	} else {
+		fn(0, BULK_SIZE / 16);
+	}
+	int64_t time = lite_time_ns() - time_start;
+	if (time == 0) time = 1;
+	lite_log(0, "%.3f ms %d Mb/s", time_ms(time), (int)(((int64_t)BULK_SIZE * 1000000000 / time) >> 20));
+}
+
+// Шифрование CTR и расшифровка CBC большого буфера в одном потоке и параллельным циклом с проверкой
+// совпадения результатов
+void test_bulk() {
+	aes128ni_t aes("My secret key...");
+	const uint8_t iv[16] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+	std::vector<uint8_t> plain(BULK_SIZE), buf(BULK_SIZE), ref(BULK_SIZE);
+	uint32_t state = 12345;
+	for (size_t i = 0; i < plain.size(); i++) {
+		state = state * 1103515245 + 12345;
+		plain[i] = (uint8_t)(state >> 16);
+	}
+	uint8_t* p = NULL; // Обрабатываемый буфер
+
+	// CTR: части шифруются независимо по номеру первого блока
+	auto ctr = [&](size_t b, size_t e) { aes.ctr(p + b * 16, (e - b) * 16, iv, b); };
+	ref = plain;
+	p = ref.data();
+	bulk_run("AES-128 CTR", false, ctr);
+	buf = plain;
+	p = buf.data();
+	bulk_run("AES-128 CTR", true, ctr);
+	if (buf != ref) lite_log(0, "AES-128 CTR parallel_for result mismatch");
+
+	// CBC: расшифровка частей независима, вектор инициализации части - предыдущий блок шифротекста.
+	// Шифротекст пишется на место результата CTR, в памяти три буфера
+	std::vector<uint8_t>& cipher = ref;
+	cipher = plain;
+	aes.cbc_encrypt(cipher.data(), cipher.size());
+	const uint8_t* c = cipher.data();
+	auto cbc = [&](size_t b, size_t e) { aes.cbc_decrypt(c + b * 16, p + b * 16, (e - b) * 16, b == 0 ? NULL : c + (b - 1) * 16); };
+	bulk_run("AES-128 CBC decrypt", false, cbc);
+	if (buf != plain) lite_log(0, "AES-128 CBC decrypt result mismatch");
+	std::fill(buf.begin(), buf.end(), 0);
+	bulk_run("AES-128 CBC decrypt", true, cbc);
+	if (buf != plain) lite_log(0, "AES-128 CBC decrypt parallel_for result mismatch");
+#ifdef _DEBUG
+	aes128ni_t_test();
+	// Исключение из части должно вернуться вызывающему lite_parallel_for()
+	bool thrown = false;
+	try {
+		lite_parallel_for(0, 64, 1, [](size_t b, size_t) { if (b == 33) throw std::runtime_error("part 33"); });
+	} catch (std::runtime_error&) {
+		thrown = true;
+	}
+	if (!thrown) lite_log(0, "parallel_for exception lost");
+#endif
+	lite_thread_end(); // Ожидание завершения
+}
+
+
+
+// Прежний вариант блокировки, для сравнения: spinlock + usleep(20)/Sleep(0) при каждой неудаче
+class spin_sleep_mutex_t {
+	std::atomic_flag af = ATOMIC_FLAG_INIT;
+
+public:
+	void lock() noexcept {
+		while (af.test_and_set(std::memory_order_acquire)) {
+#if defined LT_WIN
+			Sleep(0);
+#else
+			usleep(20);
+#endif
+		}
+	}
+
+	void unlock() noexcept {
+		af.clear(std::memory_order_release);
+	}
+};
+
+// Замер скорости блокировки при одновременном доступе из нескольких потоков
+template <typename T>
+void lock_test(const char* descr) {
+	T mtx;
+	uint64_t counter = 0;
+	size_t thread_count = std::thread::hardware_concurrency();
+	if (thread_count < 2) thread_count = 2;
+	if (thread_count > 8) thread_count = 8;
+
+	int64_t time_start = lite_time_ns();
+	std::vector<std::thread> th;
+	for (size_t i = 0; i != thread_count; i++) {
+		th.push_back(std::thread([&mtx, &counter, thread_count]() {
+			for (size_t n = 0; n != LOCK_COUNT / thread_count; n++) {
+				std::lock_guard<T> lck(mtx);
+				counter++;
+			}
+		}));
+	}
+	for (auto& t : th) t.join();
+	int64_t time = lite_time_ns() - time_start;
+	lite_log(0, "lock %s: %d threads %.3f ms %.1f ns/lock", descr, (int)thread_count, time_ms(time), (double)time / (double)counter);
+}
+
+// Запись в лог строк, не помещающихся в запись целиком: вторая строка начинается в последних 8 байтах
+// записи. Точность .0 скрывает строки при выводе
+static void test_log_long() {
+	std::string s1(LITE_LOG_BUF_SIZE - 17, 'a'), s2(100, 'b');
+	lite_log(0, "test log long strings%.0s%.0s", s1.c_str(), s2.c_str());
+}
 
 int main() {
 	printf("compile %s %s\n", __DATE__, __TIME__);
-	
+#ifdef TEST_AFFINITY
+	lite_thread_affinity(TEST_AFFINITY);
+#endif
+	lite_log(0, "%s", lite_thread_affinity_descr().c_str());
+	lite_log(0, "clock %s", lite_clock_t::is_tsc() ? "TSC" : "system");
+	test_log_long();
+	int cores = (int)std::thread::hardware_concurrency();
+	lite_thread_pool(cores, 50);
+
+	lock_test<lite_mutex_t>(LOCK_TYPE_LT);
+	lock_test<spin_sleep_mutex_t>("spinlock + sleep");
+	lock_test<std::mutex>("std::mutex");
+	lite_thread_end();
+
 	test("send to next", new empty_t());
+	test("send to next (fused)", new empty_t(), true);
+	test_relay(10);
+	test_relay(1000);
+	test_relay(10000);
+	test_relay(1000, 1);
+	test_wait_idle();
+	test_fan_in(4, 1);
+	test_fan_in(4, FAN_BATCH);
+#ifdef LT_STAT
+	lite_stat_export(NULL, LT_STAT_CSV, 2); // Выгрузка статистики в лог во время теста
+#endif
+	test_timer(1000, 100, 100, LT_TIMER_THREAD);
+#ifdef LT_STAT
+	lite_stat_export(NULL, LT_STAT_JSON, 2);
+#endif
+	test_timer(1000, 100, 100, LT_TIMER_WORKER);
+	test_priority(LT_PRIO_NORMAL);
+	test_priority(LT_PRIO_HIGH);
+	test_overload(OVER_NONE);
+	test_overload(OVER_CAPACITY);
+	test_overload(OVER_CREDIT);
+	test_fan_out(3, false);
+	test_fan_out(3, true);
 	test("XOR SHIFT crypt", new xor_shift_t());
+	test_chain("XOR SHIFT -> CRC32 actors", {new xor_shift_t(), new crc32_t()});
+	test("XOR SHIFT + CRC32 pipeline", new pipeline_t<xor_shift_stage_t, crc32_stage_t>());
+	test_pipeline<xor_shift_stage_t, crc32_stage_t>("XOR SHIFT + CRC32 pipeline parallel", cores);
 	test("XOR SHIFT + CBC encrypt", new cbc_xor_encrypt_t());
 	test("RC4 crypt", new rc4_crypt_t());
 	
@@ -286,9 +1201,21 @@ int main() {
 		return 1;
 	}
 	test("AES-128 encrypt", new aes_encrypt_t());
+	test_chain("AES-128 -> XOR SHIFT -> CRC32 actors", {new aes_encrypt_t(), new xor_shift_t(), new crc32_t()});
+	test("AES-128 + XOR SHIFT + CRC32 pipeline", new pipeline_t<aes_encrypt_stage_t, xor_shift_stage_t, crc32_stage_t>());
+	test_pipeline<aes_encrypt_stage_t, xor_shift_stage_t, crc32_stage_t>("AES-128 + XOR SHIFT + CRC32 pipeline parallel", cores);
 	test("AES-128 decrypt", new aes_decrypt_t());
 	test("AES-128 + CBC encrypt", new aes_cbc_encrypt_t());
+	test("AES-128 + CBC encrypt x4 batch", new aes_cbc_encrypt4_t());
 	test("AES-128 + CBC decrypt", new aes_cbc_decrypt_t());
+	test_flow(1, false);
+	test_flow(std::max(cores, 4), false); // Не менее 4 потоков, чтобы порядок нарушался и восстанавливался
+	test_flow(std::max(cores, 4), true);
+	test_shard(1, 0);
+	test_shard(64, 0);
+	test_shard(64, 1.0);
+	test_shard(64, 1.5);
+	test_bulk();
 	test("XOR128 + CBC encrypt", new aes_xor128_cbc_encrypt_t());
 	test("XOR128 + CBC decrypt", new aes_xor128_cbc_decrypt_t());
 }
\ No newline at end of file
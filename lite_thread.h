@@ -53,6 +53,11 @@ msg_t* msg = new msg_t;
 --- Передача сообщения на обработку.
 actor->run(msg)
 
+--- Передача пачки сообщений на обработку.
+actor->run_batch(msgs, n)
+Сообщения массива msgs добавляются в очередь актора цепочкой за одну блокировку, актор ставится
+в очередь готовых к выполнению один раз. Порядок обработки совпадает с порядком в массиве.
+
 --- Копирование сообщения.
 T* lite_msg_copy(T* msg)
 При копировании сообщения полученного извне не использовать и не отправлять исходное, т.к. оно
@@ -60,6 +65,12 @@ T* lite_msg_copy(T* msg)
 При копировании копии или явно созданного создается полноценная копия, т.е. можно использовать оба.
 В классе сообщения необходимо прописывать конструктор копирования.
 
+--- Рассылка сообщения нескольким акторам без копирования.
+lite_msg_share(msg, {actor1, actor2, ...})
+Сообщение становится общим: каждому получателю ставится в очередь небольшой конверт со ссылкой на
+него, а само сообщение удаляется после обработки последним получателем. Общее сообщение изменять
+нельзя. Его можно отправить дальше, при этом оно остается общим. lite_msg_copy() создает изменяемую копию.
+
 --- Удаление сообщения.
 delete msg
 Полученные извне и отправленные сообщения удалять нельзя, т.к. сообщения удаляются автоматически после 
@@ -101,6 +112,10 @@ actor->name_set(const std::string& name);
 
 --- Получение объекта по имени
 lite_actor_t* lite_actor_get(const std::string& name)
+Поиск без блокировок. Для частых обращений по имени можно один раз создать ссылку, повторный поиск
+выполняется только после изменения имен акторов:
+lite_actor_ref_t ref("name");
+lite_actor_t* la = ref.get();
 
 --- Удаление объекта
 lite_actor_destroy(lite_actor_t* la);
@@ -133,13 +148,106 @@ type_add(lite_msg_type<T>())
 actor->parallel_set(int max_threads)
 
 
+actor->order_set(lite_actor_t* next)
+
+Многопоточный актор с сохранением порядка: сообщения нумеруются при извлечении из очереди,
+обрабатываются параллельно, а после обработки отправляются актору next в порядке номеров. Обработчик
+не отправляет сообщение сам, а изменяет его на месте. Сообщение, отправленное обработчиком дальше
+или скопированное через lite_msg_copy(), из порядка исключается. Обработанные раньше очереди
+сообщения ждут в кольце из LT_ORDER_RING ячеек, отправку выполняет один поток без блокировок.
+Если кольцо заполнено из-за долгой обработки более раннего сообщения, обработчики ждут.
+Вызывать до отправки сообщений, приоритеты сообщений у такого актора не используются.
+
+
+РАЗДЕЛЕНИЕ ПО КЛЮЧУ --------------------------------------------------------------------------
+
+lite_shard_t<actor_t> shards(size_t count, args...)
+shards.run(msg, uint64_t key)
+
+Для множества потоков данных, каждый из которых требует обработки по порядку: создается count
+однопоточных акторов actor_t (конструктору передаются args), ключ сообщения перемешивается и по нему
+выбирается часть. Сообщения одного ключа обрабатываются одной частью по порядку, разные части
+выполняются параллельно. Состояние потоков данных хранится в своей части без блокировок.
+shards.get(key) возвращает часть ключа, shards.shard(i) - часть по номеру.
+
+actor->home_set(int n)
+
+Актор ставится в очередь готовых к выполнению потока n, а не потока-отправителя. Части раздела
+распределяются так по рабочим потокам: по пулу lite_thread_pool(), заданному до создания раздела, без
+пула - по количеству ядер. Свободные потоки забирают их из чужих очередей как обычно.
+
+
+ПАКЕТНАЯ ОБРАБОТКА ---------------------------------------------------------------------------
+
+actor->batch_set(int max)
+
+Сообщения из очереди передаются в recv_batch() пачками до max штук (не более LT_BATCH_MAX), например
+для одновременного шифрования нескольких сообщений. По умолчанию max = 1 и вызывается recv().
+class actor_t : public lite_actor_t {
+	void recv_batch(lite_msg_t** msgs, size_t n) override {
+	}
+}
+Реализация по умолчанию вызывает recv() для каждого сообщения.
+Каждое сообщение пачки ведет себя как полученное в recv(): удаляется после обработки, если не было
+отправлено дальше или скопировано через lite_msg_copy().
+
+
+ПРИОРИТЕТЫ СООБЩЕНИЙ -------------------------------------------------------------------------
+
+actor->run(msg, int prio)
+actor->priority_set(lite_msg_type<T>(), int prio)
+
+У актора LT_PRIO_LANES очередей сообщений: LT_PRIO_HIGH, LT_PRIO_NORMAL (по умолчанию), ..., LT_PRIO_LOW.
+Приоритет задается при отправке или для типа сообщения (priority_set() вызывать до отправки актору
+сообщений). Сначала обрабатываются сообщения высшего приоритета. Чтобы низкие приоритеты не простаивали
+под нагрузкой, непустая очередь, пропущенная LT_PRIO_AGING раз, обслуживается вне очереди. Очереди
+кроме обычной создаются при первом использовании.
+
+
+ПРЯМОЙ ВЫЗОВ ---------------------------------------------------------------------------------
+
+actor->fuse_set(bool on)
+
+Для актора с включенным прямым вызовом run() из обработчика другого актора выполняет обработку
+сразу в текущем потоке, без постановки в очередь готовых к выполнению. Так цепочка однопоточных
+акторов работает как последовательность вызовов функций. Прямой вызов выполняется только если
+актор свободен (не выполняется и не ожидает выполнения), однопоточный и использует тот же ресурс,
+а глубина вложенных прямых вызовов меньше LT_FUSE_DEPTH. Иначе сообщение ставится в очередь.
+Обработчик отправителя продолжается после завершения обработки получателем.
+
+
+ОГРАНИЧЕНИЕ ОЧЕРЕДИ --------------------------------------------------------------------------
+
+actor->capacity_set(size_t max)
+bool actor->try_run(msg, int prio)
+
+capacity_set() ограничивает очередь актора max сообщениями, вызывать до отправки ему сообщений.
+try_run() не ждет: при заполненной очереди возвращает false, сообщение остается у отправителя.
+Отклоненное обрабатываемое сейчас сообщение снимается с автоудаления, его можно отправить позже,
+а если оно не нужно - удалить самому.
+run() ставит сообщение в очередь без проверки ограничения.
+
+lite_credit_t credit(count)
+bool credit.take(actor, n)
+credit.give(n)
+
+Кредиты между стадиями конвейера: отправитель берет кредит на каждое сообщение, получатель
+возвращает его после обработки. Если кредитов нет, take() возвращает false и запоминает актор
+отправителя, при возврате кредитов у него вызывается timer(). Отправитель у объекта кредитов один.
+
+
 ЗАПУСК ПО ТАЙМЕРУ ----------------------------------------------------------------------------
 
 actor->timer_set(int time_ms)
+actor->timer_set_us(int64_t time_us)
 
-Устанавливает период запуска с интервалом time_ms. Отсчет начинается с момента установки.
+Устанавливает период запуска с интервалом time_ms (time_us). Отсчет начинается с момента установки.
 При time_ms <= 0 отключение таймера.
 
+Таймеры хранятся в иерархическом колесе с шагом LT_TIMER_TICK_US (по умолчанию 10 мкс), установка
+и отключение таймера O(1). Срабатывания обрабатывает отдельный поток, либо после вызова
+lite_timer_mode(LT_TIMER_WORKER) до первой установки таймера - рабочие потоки между запусками акторов.
+
 В дочернем классе необходимо прописать метод timer()
 class actor_t : public lite_actor_t {
 	void timer() override {
@@ -150,6 +258,21 @@ class actor_t : public lite_actor_t {
 очереди сообщений актора. Если по каким-либо причинам был пропушен момент запуска и наступил следующий, 
 то запуск будет один раз.
 
+ПАРАЛЛЕЛЬНЫЙ ЦИКЛ ----------------------------------------------------------------------------
+
+lite_parallel_for(size_t begin, size_t end, size_t grain, fn)
+
+Вызывает fn(size_t b, size_t e) для частей диапазона [begin, end) не более grain итераций, например
+для шифрования большого буфера. Диапазон делится пополам рекурсивно: участник берет наибольший
+ожидающий диапазон и отдает правые половины другим. Участвуют вызывающий поток и помощники в рабочих
+потоках (не более max(количество процессоров, размер пула) всего), возврат после выполнения всех
+частей. Можно вызывать из актора: вызывающий выполняет части сам, а ждет только взятые помощниками.
+Если fn выбросит исключение, невыполненные части пропускаются, а первое исключение после завершения
+взятых частей выбрасывается из lite_parallel_for() в вызывающем потоке.
+lite_parallel_for(0, size / 16, 0x4000, [&](size_t b, size_t e) {
+	aes.ctr(buf + b * 16, (e - b) * 16, iv, b);
+});
+
 ОБРАБОТКА ИСКЛЮЧЕНИЙ -------------------------------------------------------------------------
 
 При возниконвении исключений в методах recv() или timer() происходит вызов обработчика исключений
@@ -187,6 +310,14 @@ lite_log(int error, const char* data, ...)
 К введенным данным добавляется дата-время и отправляется сообщением на актор с именем "log", где
 по умолчанию выводится в консоль.
 
+Запись не форматируется сразу: указатель на строку формата, время и значения аргументов (строки
+копируются) без блокировок пишутся в кольцевой буфер потока размером LT_LOG_RING_SIZE. Форматирование
+и вывод пачками в порядке времени выполняет актор вывода, его извещает только первая запись после
+очередного чтения буфера. Поэтому строка формата должна быть постоянной (литерал), а не временным
+буфером. При переполнении буфера запись теряется, в лог выводится ошибка LITE_ERROR_LOG_DROP, общее
+количество потерянных возвращает lite_log_dropped().
+#define LT_LOG_RING_SIZE 0x10000
+
 В случае если error != 0 в текст дописывается "Error" и номер ошибки. 
 Номера менее LITE_ERROR_USER используются библиотекой.
 
@@ -205,16 +336,29 @@ lite_thread_end()
 Ожидает когда будет полностью завершена работа, удаляет все потоки, акторы и т.д. Возвращает
 библиотеку в нулевое состояние. Можно вызывать многократно.
 
+--- Ожидание отсутствия работы без завершения
+lite_thread_wait_idle()
+Ожидает когда не останется акторов с необработанными сообщениями, ожидающих и выполняющихся.
+Потоки и акторы сохраняются, после возврата можно продолжать отправку сообщений. Таймеры не
+учитываются. Вызывать не из акторов.
+
+Ожидание без опроса: учитывается общее количество постановок акторов в очереди готовых к выполнению,
+включая выполняющиеся, обнуление которого будит ожидающих.
+
 
 ОСОБЕННОСТИ РАБОТЫ -------------------------------------------------------------------------
 
 Каждый актор имеет очередь входящих сообщений. Отправка сообщения актору это постановка его
 в очередь актора и пробуждение простаивающего потока для его обработки.
 
+Актор в котором появилась работа ставится в очередь готовых к выполнению потока-отправителя, причем
+только один раз, пока он не будет выполнен (многопоточный актор не более parallel_set() раз). Поток 
+берет акторы из своей очереди, а когда она пуста - из очереди случайно выбранного другого потока.
+
 Поток захвативший актор выполняет его в цикле до тех пор пока очередь сообщений актора не опустеет.
 
-При запуске актора происходит захват ресурса, к которому привязан актор, по окончании работы актора,
-ищется ожидающий выполнения актор привязанный к этому же ресурсу.
+При запуске актора происходит захват ресурса, к которому привязан актор. Если ресурс занят, то актор
+ожидает в кэше ресурса и ставится в очередь готовых к выполнению при освобождении ресурса.
 
 При обработке последнего сообщения в очереди актора происходит перехват исходящего сообщения актору 
 с тем же ресурсом, чтобы по завершению работы с текущим актором в том же потоке запустить получателя.
@@ -225,6 +369,77 @@ lite_thread_end()
 новый. Потоки нумеруются при создании, при простаивании приоритет пробуждения отдается потоку с меньшим 
 номером. Если поток с максимальным номером простаивает 1 секунду - он завершается.
 
+--- Пул заранее запущенных потоков
+lite_thread_pool(size_t count, int spin_us)
+Сразу запускает count потоков, которые не завершаются при простое (количество потоков не опускается ниже
+count). После lite_thread_end() пул запускается заново при первой отправке сообщения.
+Поток без работы spin_us микросекунд опрашивает очереди и только затем засыпает, что сокращает
+задержку на пробуждение ценой загрузки процессора.
+
+--- Количество рабочих потоков
+lite_thread_workers()
+Размер пула, без пула - количество ядер. По нему части lite_shard_t распределяются по потокам.
+
+
+НАСТРОЙКА ---------------------------------------------------------------------------------
+
+--- Количество попыток захвата блокировки lite_mutex_t в цикле перед засыпанием
+#define LT_SPIN_COUNT 128
+Под Linux ожидающий поток засыпает на futex и будится при освобождении, на остальных платформах
+ожидание через Sleep(0)/usleep().
+
+--- Пул памяти сообщений
+Память под сообщения и акторы выделяется из пула потока блоками кратными 64 байтам. Блок освобожденный
+в другом потоке возвращается в пул выделившего его потока пачками.
+#define LT_MSG_POOL_CLASS 64	// Количество размерных классов, сообщения больше 64 * 64 байт выделяются вне пула
+#define LT_MSG_POOL_SIZE 1024	// Максимум свободных блоков одного размера в пуле потока
+#define LT_MSG_POOL_BATCH 32	// Размер пачки возвращаемой в пул другого потока
+
+--- Привязка потоков к процессорам
+lite_thread_affinity(int policy, const std::vector<int>& cpu_list)
+Вызывается до запуска потоков. policy:
+LT_AFFINITY_NONE	- без привязки (по умолчанию)
+LT_AFFINITY_COMPACT	- потоки подряд на процессоры с общим кэшем L2, затем L3, затем сокет
+LT_AFFINITY_SCATTER	- потоки вразброс по сокетам, кэшам L3 и L2
+LT_AFFINITY_LIST	- по списку номеров процессоров cpu_list
+Топология читается из /sys/devices/system/cpu. При включенной привязке пробуждается в первую очередь 
+свободный поток с общим кэшем L2/L3, и поток без работы забирает акторы сначала у потоков с общим L3.
+lite_thread_affinity_descr() возвращает описание назначения потоков процессорам.
+
+--- Память на узлах NUMA
+Если в системе больше одного узла NUMA (/sys/devices/system/node), то пул потока выделяет память под
+сообщения и акторы страницами LT_NUMA_SLAB, привязанными через mbind() к узлу потока. При одном узле
+или без mbind() память выделяется обычным образом. Статистика numa_node считает обработанные сообщения,
+выделенные на узле обработавшего потока (local) и на другом узле (remote).
+#define LT_NUMA_SLAB 0x10000	// Размер страницы пула на узле NUMA
+#define LT_NUMA_NODES 8			// Количество узлов в статистике
+
+--- Максимальный размер пачки сообщений передаваемой в recv_batch()
+#define LT_BATCH_MAX 16
+
+--- Приоритеты сообщений: количество очередей актора (2..4) и через сколько сообщений высших
+приоритетов обслуживается ожидающая очередь низшего
+#define LT_PRIO_LANES 3
+#define LT_PRIO_AGING 16
+
+--- Максимальная глубина вложенных прямых вызовов акторов (fuse_set)
+#define LT_FUSE_DEPTH 8
+
+--- Размер кольца упорядочивания многопоточного актора (order_set), степень 2
+#define LT_ORDER_RING 1024
+
+--- Количество очередей готовых к выполнению акторов
+#define LT_READY_QUEUES 64
+Каждый поток имеет свою очередь, потоки с номером больше LT_READY_QUEUES и сторонние потоки используют
+общую очередь.
+
+--- Часы
+lite_time_ns() - монотонное время в нс, lite_cycles() - счетчик тактов, lite_cycles_ns() - перевод в нс.
+На x86 с инвариантным TSC время считается по rdtsc с калибровкой (10 мс) в lite_thread_pool(), перед
+запуском первого рабочего потока или при более раннем обращении к часам, иначе через
+clock_gettime(CLOCK_MONOTONIC) или steady_clock. Отключение TSC:
+#define LT_NO_TSC
+
 
 ОТЛАДКА -----------------------------------------------------------------------------------
 
@@ -237,6 +452,17 @@ lite_thread_end()
 --- Включение счетчиков статистики
 #define LT_STAT
 Выводятся по окончании lite_thread_end(). Назначение описано ниже в lite_thread_stat_t
+Дополнительно по каждому актору собираются гистограммы времени ожидания сообщения в очереди (wait)
+и времени обработки (work), выводятся p50/p99/p999 в мкс. Акторы группируются по имени, безымянные
+по классу. Максимум групп:
+#define LT_HIST_KEYS 256
+Во время работы счетчики всех потоков суммируются lite_stat_snapshot(), а lite_stat_export(file, format,
+period_ms) раз в период дописывает строку JSON или CSV (сообщений в секунду, потоки, очереди, доли попаданий
+в кэш и пул) в файл или в лог.
+
+--- Подсчет максимальной глубины очереди сообщений (queue_max), вместе с LT_STAT
+#define LT_STAT_QUEUE
+Добавляет счетчик размера в каждую очередь, без него queue_max не выводится и не выгружается.
 
 --- Вывод в лог информации о состоянии потоков
 #define LT_DEBUG
@@ -255,18 +481,70 @@ lite_thread_end()
 #include <unistd.h>
 #endif
 
+#if defined(__linux__)
+#define LT_FUTEX
+#include <pthread.h>
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#ifdef SYS_mbind
+#define LT_NUMA
+#endif
+#endif
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define LT_X86
+#include <emmintrin.h> // _mm_pause()
+#if defined(_MSC_VER)
+#include <intrin.h> // __rdtsc(), __cpuid()
+#else
+#include <x86intrin.h> // __rdtsc()
+#include <cpuid.h>
+#endif
+#endif
+
 #define LT_VERSION "0.9.2" // Версия библиотеки
 
 #ifndef LT_RESOURCE_DEFAULT
 #define LT_RESOURCE_DEFAULT 32 // Предел ресурса по умолчанию
 #endif
 
+#ifndef LT_READY_QUEUES
+#define LT_READY_QUEUES 64 // Количество очередей готовых к выполнению акторов, по одной на поток
+#endif
+
+#ifndef LT_BATCH_MAX
+#define LT_BATCH_MAX 16 // Максимальный размер пачки сообщений для recv_batch()
+#endif
+
+#ifndef LT_PRIO_LANES
+#define LT_PRIO_LANES 3 // Количество приоритетов сообщений (очередей актора), от 2 до 4
+#endif
+
+#ifndef LT_PRIO_AGING
+#define LT_PRIO_AGING 16 // Через сколько сообщений высших приоритетов обслуживается ожидающая очередь низшего
+#endif
+
+#ifndef LT_FUSE_DEPTH
+#define LT_FUSE_DEPTH 8 // Максимальная глубина вложенных прямых вызовов акторов
+#endif
+
+#ifndef LT_ORDER_RING
+#define LT_ORDER_RING 1024 // Размер кольца упорядочивания многопоточного актора (order_set), степень 2
+#endif
+
+#define LT_PRIO_HIGH	0					// Высокий приоритет
+#define LT_PRIO_NORMAL	1					// Обычный приоритет, по умолчанию
+#define LT_PRIO_LOW		(LT_PRIO_LANES - 1)	// Низкий приоритет
+
 #define LITE_ERROR_NOT_IMPLEMENTED	1  // Не прописан обработчик актора
 #define LITE_ERROR_RESOURCE			2  // Актор использует другой ресурс
 #define LITE_ERROR_ACTOR_DOUBLE		3  // Попытка присвоить имя уже существующего актора
 #define LITE_ERROR_ACTOR_NAME		4  // Попытка смены имени актора
 #define LITE_ERROR_MSG_TYPE			5  // Сообщение необрабатываемого типа
 #define LITE_ERROR_EXCEPTION		6  // Исключение в коде актора
+#define LITE_ERROR_LOG_DROP			7  // Записи лога потеряны при переполнении буфера потока
 #define LITE_ERROR_USER				16 // Пользовательские коды ошибок начиная с LITE_ERROR_USER
 #ifdef LT_DEBUG
 #ifdef NDEBUG
@@ -277,16 +555,27 @@ lite_thread_end()
 #include <atomic>
 #include <vector>
 #include <queue>
+#include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <unordered_map>
 #include <map>
 #include <string>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <exception>
 #include <assert.h>
 #include <time.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <stdarg.h>
+#if defined(LT_STAT) && defined(__GNUG__)
+#include <cxxabi.h> // abi::__cxa_demangle()
+#endif
 
 //----------------------------------------------------------------------------------
 //-------- ВЫРАВНИВАНИЕ В ПАМЯТИ ---------------------------------------------------
@@ -406,28 +695,199 @@ public:
 //------ СЧЕТЧИКИ СТАТИСТИКИ -------------------------------------------------------
 //----------------------------------------------------------------------------------
 static int64_t lite_time_now();
+static int64_t lite_time_us() noexcept;
+static int lite_numa_node() noexcept;
+
+#ifndef LT_NUMA_NODES
+#define LT_NUMA_NODES 8 // Количество узлов NUMA в статистике
+#endif
 
-class lite_thread_stat_t : public lite_thread_info_t<lite_thread_stat_t>, public lite_static_info_t<lite_thread_stat_t> {
+#ifndef LT_HIST_KEYS
+#define LT_HIST_KEYS 256 // Количество групп акторов в гистограммах задержек
+#endif
+
+// Гистограмма задержек в нс. Интервалы по степеням 2, каждый разбит на 16 равных (погрешность до 6%)
+struct lite_hist_t {
+	static const int sub_bits = 4;
+	static const int max_bits = 40; // Значения от 2^40 нс (~18 минут) попадают в последний интервал
+	static const int bucket_count = (max_bits - sub_bits + 2) << sub_bits;
+
+	uint64_t count[bucket_count];
+
+	static int bucket(int64_t ns) noexcept {
+		if (ns < (1 << sub_bits)) return ns < 0 ? 0 : (int)ns;
+		if (ns >= ((int64_t)1 << (max_bits + 1))) return bucket_count - 1;
+		int e = sub_bits;
+		while ((ns >> (e + 1)) != 0) e++; // Номер старшего бита
+		return ((e - sub_bits + 1) << sub_bits) + (int)((ns >> (e - sub_bits)) & ((1 << sub_bits) - 1));
+	}
+
+	// Верхняя граница интервала
+	static int64_t value(int idx) noexcept {
+		if (idx < (1 << sub_bits)) return idx;
+		int e = (idx >> sub_bits) + sub_bits - 1;
+		int64_t low = (int64_t)((1 << sub_bits) + (idx & ((1 << sub_bits) - 1))) << (e - sub_bits);
+		return low + ((int64_t)1 << (e - sub_bits)) - 1;
+	}
+
+	void add(int64_t ns, uint64_t n = 1) noexcept {
+		count[bucket(ns)] += n;
+	}
+
+	void merge(const lite_hist_t& h) noexcept {
+		for (int i = 0; i < bucket_count; i++) count[i] += h.count[i];
+	}
+
+	uint64_t total() const noexcept {
+		uint64_t n = 0;
+		for (int i = 0; i < bucket_count; i++) n += count[i];
+		return n;
+	}
+
+	// Значение, не больше которого доля p значений
+	int64_t percentile(double p) const noexcept {
+		uint64_t n = total();
+		if (n == 0) return 0;
+		uint64_t need = (uint64_t)(p * n);
+		if (need < 1) need = 1;
+		uint64_t sum = 0;
+		for (int i = 0; i < bucket_count; i++) {
+			sum += count[i];
+			if (sum >= need) return value(i);
+		}
+		return value(bucket_count - 1);
+	}
+};
+
+// Гистограммы одной группы акторов
+struct lite_actor_hist_t {
+	lite_hist_t wait;	// Ожидание сообщения в очереди
+	lite_hist_t work;	// Обработка сообщения
+};
+
+// Читаемое название класса
+static std::string lite_type_name(const std::type_info& type) {
+	#ifdef __GNUG__
+	int status = 0;
+	char* s = abi::__cxa_demangle(type.name(), NULL, NULL, &status);
+	if (s != NULL) {
+		std::string name = s;
+		free(s);
+		return name;
+	}
+	#endif
+	return type.name();
+}
+
+// Счетчик статистики. Изменяется только своим потоком, поэтому relaxed чтение и запись без атомарного
+// приращения, а lite_stat_snapshot() читает счетчики работающих потоков без гонки данных
+class lite_stat_count_t {
+	std::atomic<size_t> v;
+
+public:
+	lite_stat_count_t() noexcept : v(0) {}
+	lite_stat_count_t(const lite_stat_count_t& x) noexcept : v((size_t)x) {}
+
+	lite_stat_count_t& operator=(const lite_stat_count_t& x) noexcept {
+		return *this = (size_t)x;
+	}
+
+	lite_stat_count_t& operator=(size_t x) noexcept {
+		v.store(x, std::memory_order_relaxed);
+		return *this;
+	}
+
+	lite_stat_count_t& operator+=(size_t x) noexcept {
+		return *this = v.load(std::memory_order_relaxed) + x;
+	}
+
+	void operator++(int) noexcept {
+		*this += 1;
+	}
+
+	operator size_t() const noexcept {
+		return v.load(std::memory_order_relaxed);
+	}
+};
+
+// Счетчики статистики
+struct lite_stat_data_t {
+	lite_stat_count_t stat_thread_max;			// Максимальное количество потоков запущенных одновременно
+	lite_stat_count_t stat_parallel_run;		// Максимальное количество потоков работавших одновременно
+	lite_stat_count_t stat_thread_create;		// Создано потоков
+	lite_stat_count_t stat_thread_wake_up;		// Сколько раз будились потоки
+	lite_stat_count_t stat_try_wake_up;		// Попыток разбудить поток
+	lite_stat_count_t stat_msg_create;			// Создано сообщений
+	lite_stat_count_t stat_msg_erase;			// Удалено сообщений
+	lite_stat_count_t stat_actor_create;		// Создано акторов
+	lite_stat_count_t stat_actor_erase;		// Удалено акторов
+	lite_stat_count_t stat_actor_get;			// Запросов lite_actor_t* по (func, env)
+	lite_stat_count_t stat_actor_find;			// Поиск очередного актора готового к работе в очередях
+	lite_stat_count_t stat_actor_steal;		// Актор взят из очереди другого потока
+	lite_stat_count_t stat_actor_not_run;		// Промахи обработки сообщения, уже обрабатывается другим потоком
+	lite_stat_count_t stat_cache_found;		// Найдено в локальном кэше потока
+	lite_stat_count_t stat_cache_bad;			// Запуск актора без работы
+	lite_stat_count_t stat_cache_full;			// Попытка записи в полный кэш ожидающих ресурс
+	lite_stat_count_t stat_res_lock;			// Количество блокировок ресурсов
+	lite_stat_count_t stat_queue_max;			// Максимальная глубина очереди
+	lite_stat_count_t stat_msg_send;			// Обработано сообщений
+	lite_stat_count_t stat_wake_up_time;		// Суммарная задержка пробуждения потока, нс
+	lite_stat_count_t stat_wake_up_max;		// Максимальная задержка пробуждения потока, нс
+	lite_stat_count_t stat_spin_found;			// Работа найдена при опросе очередей до засыпания
+	lite_stat_count_t stat_prio_aged;			// Сообщений низшего приоритета обработано вне очереди по старению
+	lite_stat_count_t stat_queue_full;			// Отказов try_run() из-за заполненной очереди
+	lite_stat_count_t stat_credit_wait;		// Ожиданий отправителя из-за отсутствия кредитов
+	lite_stat_count_t stat_fused;				// Прямых вызовов акторов без постановки в очередь готовых
+	lite_stat_count_t stat_order_held;			// Сообщений, ожидавших в кольце упорядочивания более раннее
+	lite_stat_count_t stat_order_wait;			// Ожиданий места в кольце упорядочивания
+	lite_stat_count_t stat_pool_hit;			// Выделено памяти под сообщения и акторы из пула потока
+	lite_stat_count_t stat_pool_miss;			// Выделено памяти под сообщения и акторы вне пула
+	lite_stat_count_t stat_numa_local[LT_NUMA_NODES];	// Обработано сообщений выделенных на узле NUMA потока
+	lite_stat_count_t stat_numa_remote[LT_NUMA_NODES];	// Обработано сообщений выделенных на другом узле
+
+	// Добавление счетчиков x
+	void add(const lite_stat_data_t& x) noexcept {
+		if(stat_thread_max < x.stat_thread_max) stat_thread_max = x.stat_thread_max;
+		if(stat_parallel_run < x.stat_parallel_run) stat_parallel_run = x.stat_parallel_run;
+		stat_thread_create += x.stat_thread_create;
+		stat_thread_wake_up += x.stat_thread_wake_up;
+		stat_try_wake_up += x.stat_try_wake_up;
+		stat_msg_create += x.stat_msg_create;
+		stat_msg_erase += x.stat_msg_erase;
+		stat_actor_create += x.stat_actor_create;
+		stat_actor_erase += x.stat_actor_erase;
+		stat_actor_get += x.stat_actor_get;
+		stat_actor_find += x.stat_actor_find;
+		stat_actor_steal += x.stat_actor_steal;
+		stat_cache_found += x.stat_cache_found;
+		stat_cache_bad += x.stat_cache_bad;
+		stat_cache_full += x.stat_cache_full;
+		stat_res_lock += x.stat_res_lock;
+		stat_actor_not_run += x.stat_actor_not_run;
+		if(stat_queue_max < x.stat_queue_max) stat_queue_max = x.stat_queue_max;
+		stat_msg_send += x.stat_msg_send;
+		stat_wake_up_time += x.stat_wake_up_time;
+		if(stat_wake_up_max < x.stat_wake_up_max) stat_wake_up_max = x.stat_wake_up_max;
+		stat_spin_found += x.stat_spin_found;
+		stat_prio_aged += x.stat_prio_aged;
+		stat_queue_full += x.stat_queue_full;
+		stat_credit_wait += x.stat_credit_wait;
+		stat_fused += x.stat_fused;
+		stat_order_held += x.stat_order_held;
+		stat_order_wait += x.stat_order_wait;
+		stat_pool_hit += x.stat_pool_hit;
+		stat_pool_miss += x.stat_pool_miss;
+		for (int i = 0; i < LT_NUMA_NODES; i++) {
+			stat_numa_local[i] += x.stat_numa_local[i];
+			stat_numa_remote[i] += x.stat_numa_remote[i];
+		}
+	}
+};
+
+class lite_thread_stat_t : public lite_stat_data_t, public lite_thread_info_t<lite_thread_stat_t>, public lite_static_info_t<lite_thread_stat_t> {
 
 public:
-	size_t stat_thread_max;			// Максимальное количество потоков запущенных одновременно
-	size_t stat_parallel_run;		// Максимальное количество потоков работавших одновременно
-	size_t stat_thread_create;		// Создано потоков
-	size_t stat_thread_wake_up;		// Сколько раз будились потоки
-	size_t stat_try_wake_up;		// Попыток разбудить поток
-	size_t stat_msg_create;			// Создано сообщений
-	size_t stat_msg_erase;			// Удалено сообщений
-	size_t stat_actor_create;		// Создано акторов
-	size_t stat_actor_erase;		// Удалено акторов
-	size_t stat_actor_get;			// Запросов lite_actor_t* по (func, env)
-	size_t stat_actor_find;			// Поиск очередного актора готового к работе
-	size_t stat_actor_not_run;		// Промахи обработки сообщения, уже обрабатывается другим потоком
-	size_t stat_cache_found;		// Найдено в глобальном кэше
-	size_t stat_cache_bad;			// Извлечение из кэша неготового актора
-	size_t stat_cache_full;			// Попытка записи в полный кэш
-	size_t stat_res_lock;			// Количество блокировок ресурсов
-	size_t stat_queue_max;			// Максимальная глубина очереди
-	size_t stat_msg_send;			// Обработано сообщений
+	lite_actor_hist_t* stat_hist[LT_HIST_KEYS];	// Гистограммы задержек по группам акторов, выделяются при первой записи
 
 	//---------------------------------------------------------------------
 	// Счетчики потока
@@ -444,39 +904,87 @@ public:
 	lite_thread_stat_t() {
 		init();
 		lite_time_now(); // Запуск отсчета времени
+		std::unique_lock<std::mutex> lck(stat_mtx()); // Блокировка
+		stat_list().push_back(this);
 	}
 
 	~lite_thread_stat_t() {
-		store();
+		if (this == &si()) {
+			for (int i = 0; i < LT_HIST_KEYS; i++) delete stat_hist[i];
+		} else {
+			store();
+		}
+		std::unique_lock<std::mutex> lck(stat_mtx()); // Блокировка
+		std::vector<lite_thread_stat_t*>& list = stat_list();
+		list.erase(std::remove(list.begin(), list.end(), this), list.end());
+	}
+
+	// Сумма счетчиков завершенных и работающих потоков. Счетчики работающих потоков читаются во время
+	// изменения, поэтому снимок не согласован между счетчиками
+	static void snapshot(lite_stat_data_t& s) noexcept {
+		s = lite_stat_data_t();
+		std::unique_lock<std::mutex> lck(stat_mtx()); // Блокировка
+		for (auto& t : stat_list()) s.add(*t);
+	}
+
+	// Номер группы гистограмм по названию, -1 если групп больше LT_HIST_KEYS
+	static int hist_key(const std::string& name) {
+		std::unique_lock<std::mutex> lck(hist_mtx()); // Блокировка
+		std::vector<std::string>& names = hist_names();
+		for (size_t i = 0; i < names.size(); i++) {
+			if (names[i] == name) return (int)i;
+		}
+		if (names.size() >= LT_HIST_KEYS) return -1;
+		names.push_back(name);
+		return (int)names.size() - 1;
+	}
+
+	// Учет обработки n сообщений группой key: ожидание в очереди wait_ns, обработка work_ns на сообщение
+	void hist_add(int key, int64_t wait_ns, int64_t work_ns, uint64_t n = 1) {
+		if (key < 0) return;
+		lite_actor_hist_t* h = stat_hist[key];
+		if (h == NULL) {
+			h = new lite_actor_hist_t();
+			stat_hist[key] = h;
+		}
+		h->wait.add(wait_ns, n);
+		h->work.add(work_ns, n);
+	}
+
+	// Учет обработки сообщения выделенного на узле node
+	void numa_count(int node) noexcept {
+		if (node < 0) return;
+		int now = lite_numa_node();
+		if (now < 0 || now >= LT_NUMA_NODES) return;
+		if (node == now) {
+			stat_numa_local[now]++;
+		} else {
+			stat_numa_remote[now]++;
+		}
 	}
 
 	// Сброс в 0
 	void init() {
-		memset(this, 0, sizeof(lite_thread_stat_t));
+		static_cast<lite_stat_data_t&>(*this) = lite_stat_data_t();
+		memset(stat_hist, 0, sizeof(stat_hist));
 	}
 
 	// Сохранение счетчиков потока в глобальные
 	void store() {
-		static std::mutex mtx;
-		std::unique_lock<std::mutex> lck(mtx); // Блокировка
-		if(si().stat_thread_max < stat_thread_max) si().stat_thread_max = stat_thread_max;
-		if(si().stat_parallel_run < stat_parallel_run) si().stat_parallel_run = stat_parallel_run;
-		si().stat_thread_create += stat_thread_create;
-		si().stat_thread_wake_up += stat_thread_wake_up;
-		si().stat_try_wake_up += stat_try_wake_up;
-		si().stat_msg_create += stat_msg_create;
-		si().stat_msg_erase += stat_msg_erase;
-		si().stat_actor_create += stat_actor_create;
-		si().stat_actor_erase += stat_actor_erase;
-		si().stat_actor_get += stat_actor_get;
-		si().stat_actor_find += stat_actor_find;
-		si().stat_cache_found += stat_cache_found;
-		si().stat_cache_bad += stat_cache_bad;
-		si().stat_cache_full += stat_cache_full;
-		si().stat_res_lock += stat_res_lock;
-		si().stat_actor_not_run += stat_actor_not_run;
-		if(si().stat_queue_max < stat_queue_max) si().stat_queue_max = stat_queue_max;
-		si().stat_msg_send += stat_msg_send;
+		if (this == &si()) return;
+		std::unique_lock<std::mutex> lck(stat_mtx()); // Блокировка
+		si().add(*this);
+		for (int i = 0; i < LT_HIST_KEYS; i++) {
+			lite_actor_hist_t* h = stat_hist[i];
+			if (h == NULL) continue;
+			if (si().stat_hist[i] == NULL) {
+				si().stat_hist[i] = h; // Перенос без копирования
+			} else {
+				si().stat_hist[i]->wait.merge(h->wait);
+				si().stat_hist[i]->work.merge(h->work);
+				delete h;
+			}
+		}
 		init();
 	}
 
@@ -488,10 +996,20 @@ public:
 		printf("thread_create  %llu\n", (uint64_t)si().stat_thread_create);
 		printf("thread_wake_up %llu\n", (uint64_t)si().stat_thread_wake_up);
 		printf("try_wake_up    %llu\n", (uint64_t)si().stat_try_wake_up);
+		printf("wake_up_avg_us %llu\n", (uint64_t)si().stat_wake_up_time / (si().stat_thread_wake_up > 0 ? si().stat_thread_wake_up : 1) / 1000);
+		printf("wake_up_max_us %llu\n", (uint64_t)si().stat_wake_up_max / 1000);
+		printf("spin_found     %llu\n", (uint64_t)si().stat_spin_found);
+		printf("prio_aged      %llu\n", (uint64_t)si().stat_prio_aged);
+		printf("queue_full     %llu\n", (uint64_t)si().stat_queue_full);
+		printf("credit_wait    %llu\n", (uint64_t)si().stat_credit_wait);
+		printf("fused          %llu\n", (uint64_t)si().stat_fused);
+		printf("order_held     %llu\n", (uint64_t)si().stat_order_held);
+		printf("order_wait     %llu\n", (uint64_t)si().stat_order_wait);
 		printf("msg_create     %llu\n", (uint64_t)si().stat_msg_create);
 		printf("actor_create   %llu\n", (uint64_t)si().stat_actor_create);
 		printf("actor_get      %llu\n", (uint64_t)si().stat_actor_get);
 		printf("actor_find     %llu\n", (uint64_t)si().stat_actor_find);
+		printf("actor_steal    %llu\n", (uint64_t)si().stat_actor_steal);
 		printf("actor_not_run  %llu\n", (uint64_t)si().stat_actor_not_run);
 		printf("cache_found    %llu\n", (uint64_t)si().stat_cache_found);
 		printf("cache_bad      %llu\n", (uint64_t)si().stat_cache_bad);
@@ -501,12 +1019,72 @@ public:
 		printf("queue_max      %llu\n", (uint64_t)si().stat_queue_max);
 		#endif
 		printf("msg_send       %llu\n", (uint64_t)si().stat_msg_send);
-		int64_t time_ms = lite_time_now();
-		printf("msg_send/sec   %llu\n", (uint64_t)si().stat_msg_send * 1000 / (time_ms > 0 ? time_ms : 1)); // Сообщений в секунду
+		int64_t time_us = lite_time_us();
+		printf("pool_hit       %llu\n", (uint64_t)si().stat_pool_hit);
+		printf("pool_miss      %llu\n", (uint64_t)si().stat_pool_miss);
+		for (int i = 0; i < LT_NUMA_NODES; i++) {
+			if (si().stat_numa_local[i] + si().stat_numa_remote[i] == 0) continue;
+			printf("numa_node%-5d local %llu remote %llu\n", i, (uint64_t)si().stat_numa_local[i], (uint64_t)si().stat_numa_remote[i]);
+		}
+		printf("msg_send/sec   %llu\n", (uint64_t)si().stat_msg_send * 1000000 / (time_us > 0 ? time_us : 1)); // Сообщений в секунду
 		printf("\n");
+		print_hist();
 		if (si().stat_msg_create != si().stat_msg_erase) printf("!!! ERROR: lost %lld messages (erase %lld)\n\n", (int64_t)si().stat_msg_create - si().stat_msg_erase, (int64_t)si().stat_msg_erase); // Утечка памяти
 		if (si().stat_actor_create != si().stat_actor_erase) printf("!!! ERROR: lost %lld actors (erase %lld)\n\n", (int64_t)si().stat_actor_create - si().stat_actor_erase, (int64_t)si().stat_actor_erase); // Утечка памяти
 	}
+
+	// Вывод гистограмм задержек по группам акторов, мкс
+	void print_hist() {
+		std::unique_lock<std::mutex> lck_stat(stat_mtx()); // Гистограммы завершающихся потоков переносятся в si() в store()
+		std::unique_lock<std::mutex> lck(hist_mtx()); // Блокировка
+		std::vector<std::string>& names = hist_names();
+		bool title = false;
+		for (size_t i = 0; i < names.size(); i++) {
+			lite_actor_hist_t* h = si().stat_hist[i];
+			if (h == NULL) continue;
+			if (!title) {
+				printf("------- LATENCY us -------\n");
+				printf("%-24s %10s %27s %27s\n", "actor", "msg", "wait p50/p99/p999", "work p50/p99/p999");
+				title = true;
+			}
+			printf("%-24.24s %10llu %8.1f %8.1f %9.1f %8.1f %8.1f %9.1f\n", names[i].c_str(), (uint64_t)h->wait.total(),
+				h->wait.percentile(0.5) / 1000.0, h->wait.percentile(0.99) / 1000.0, h->wait.percentile(0.999) / 1000.0,
+				h->work.percentile(0.5) / 1000.0, h->work.percentile(0.99) / 1000.0, h->work.percentile(0.999) / 1000.0);
+		}
+		if (title) printf("\n");
+	}
+
+private:
+	// Счетчики всех потоков, включая итоговые si()
+	static std::vector<lite_thread_stat_t*>& stat_list() {
+		static std::vector<lite_thread_stat_t*> list;
+		return list;
+	}
+
+	// Блокировка stat_list() и переноса счетчиков потоков в итоговые
+	static std::mutex& stat_mtx() {
+		static std::mutex mtx;
+		return mtx;
+	}
+
+	// Названия групп гистограмм
+	static std::vector<std::string>& hist_names() {
+		static std::vector<std::string> names;
+		return names;
+	}
+
+	static std::mutex& hist_mtx() {
+		static std::mutex mtx;
+		return mtx;
+	}
+};
+
+// Снимок статистики без остановки работы, lite_stat_snapshot()
+struct lite_stat_snapshot_t : public lite_stat_data_t {
+	int64_t time_us;		// Время снимка с момента запуска, мкс
+	size_t thread_count;	// Запущено рабочих потоков
+	size_t thread_work;		// Из них выполняют акторы
+	size_t actor_ready;		// Акторов в очередях готовых к выполнению
 };
 
 #endif
@@ -514,27 +1092,69 @@ public:
 //----------------------------------------------------------------------------------
 //------ БЛОКИРОВКИ ----------------------------------------------------------------
 //----------------------------------------------------------------------------------
-#define LOCK_TYPE_LT "spinlock + Sleep(0)"
+#ifdef LT_FUTEX
+#define LOCK_TYPE_LT "spin + futex"
+#else
+#define LOCK_TYPE_LT "spin + Sleep(0)"
+#endif
+
+#ifndef LT_SPIN_COUNT
+#define LT_SPIN_COUNT 128 // Количество попыток захвата блокировки перед засыпанием
+#endif
+
+// Пауза в цикле ожидания
+static inline void lite_cpu_relax() noexcept {
+#ifdef LT_X86
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
 
+// Блокировка: ограниченное ожидание в цикле, затем засыпание до освобождения
 class lite_mutex_t {
-	std::atomic_flag af = ATOMIC_FLAG_INIT;
+	std::atomic<int> state = {0}; // 0 - свободна, 1 - захвачена, 2 - захвачена и есть ожидающие
+
+	// Ожидание пока state == val
+	void wait(int val) noexcept {
+#if defined LT_FUTEX
+		syscall(SYS_futex, (int*)&state, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#elif defined LT_WIN
+		(void)val;
+		Sleep(0);
+#else
+		(void)val;
+		usleep(20);
+#endif
+	}
+
+	// Пробуждение одного ожидающего
+	void wake() noexcept {
+#if defined LT_FUTEX
+		syscall(SYS_futex, (int*)&state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#endif
+	}
 
 public:
 	void lock() noexcept {
-		while (af.test_and_set(std::memory_order_acquire)) {
-#if defined LT_WIN
-			Sleep(0);
-#else
-			usleep(20);
-#endif
+		int s = 0;
+		if (state.compare_exchange_strong(s, 1, std::memory_order_acquire)) return;
+		// Ожидание в цикле
+		for (int i = 0; i < LT_SPIN_COUNT; i++) {
+			lite_cpu_relax();
+			s = 0;
+			if (state.load(std::memory_order_relaxed) == 0 && state.compare_exchange_weak(s, 1, std::memory_order_acquire)) return;
+		}
+		// Засыпание, при выходе блокировка остается с пометкой о наличии ожидающих
+		while (state.exchange(2, std::memory_order_acquire) != 0) {
+			wait(2);
 		}
-
 	}
 
 	void unlock() noexcept {
-		af.clear(std::memory_order_release);
+		if (state.exchange(0, std::memory_order_release) == 2) wake();
 	}
-}; 
+};
 
 
 class lite_lock_t {
@@ -550,12 +1170,157 @@ public:
 	}
 };
 
+//----------------------------------------------------------------------------------
+//------ ЧАСЫ ----------------------------------------------------------------------
+//----------------------------------------------------------------------------------
+#if defined LT_X86 && !defined LT_NO_TSC
+#define LT_TSC
+#endif
+
+// Монотонные часы с наносекундным разрешением. При инвариантном TSC время считается по счетчику тактов
+class lite_clock_t {
+	struct static_info_t : public lite_static_info_t<static_info_t> {
+		bool use_tsc = {false};		// Время по TSC
+		uint64_t tsc_start = {0};	// Значение TSC при калибровке
+		int64_t ns_start = {0};		// Время при калибровке, нс
+		uint64_t mult = {0};		// Нс на такт, фиксированная точка 32.32
+
+		static_info_t() {
+			ns_start = sys_ns();
+			#ifdef LT_TSC
+			if (!tsc_invariant()) return;
+			// Калибровка по системным часам
+			int64_t ns0, ns1;
+			uint64_t tsc0, tsc1;
+			sample(ns0, tsc0);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			sample(ns1, tsc1);
+			if (tsc1 <= tsc0 || ns1 <= ns0) return;
+			uint64_t m = ((uint64_t)(ns1 - ns0) << 32) / (tsc1 - tsc0);
+			if (m == 0 || m >= ((uint64_t)1 << 32)) return; // Частота TSC меньше 1 ГГц
+			tsc_start = tsc1;
+			ns_start = ns1;
+			mult = m;
+			use_tsc = true;
+			#endif
+		}
+
+		#ifdef LT_TSC
+		// Пара значений системных часов и TSC. Из нескольких замеров берется самый короткий
+		static void sample(int64_t& ns, uint64_t& tsc) noexcept {
+			int64_t best = INT64_MAX;
+			ns = 0;
+			tsc = 0;
+			for (int i = 0; i < 16; i++) {
+				int64_t t0 = sys_ns();
+				uint64_t c = __rdtsc();
+				int64_t t1 = sys_ns();
+				if (t1 - t0 < best) {
+					best = t1 - t0;
+					ns = t0 + (t1 - t0) / 2;
+					tsc = c;
+				}
+			}
+		}
+		#endif
+	};
+
+	static static_info_t& si() noexcept {
+		return static_info_t::si();
+	}
+
+	#ifdef LT_TSC
+	// TSC не зависит от частоты и состояния процессора
+	static bool tsc_invariant() noexcept {
+		#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0x80000000);
+		if ((unsigned int)info[0] < 0x80000007) return false;
+		__cpuid(info, 0x80000007);
+		return (info[3] & 0x100) != 0;
+		#else
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return false;
+		return (edx & 0x100) != 0;
+		#endif
+	}
+	#endif
+
+public:
+	// Системное монотонное время, нс
+	static int64_t sys_ns() noexcept {
+		#if defined __linux__
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		#endif
+	}
+
+	// Счетчик тактов, без TSC - нс
+	static uint64_t cycles() noexcept {
+		#ifdef LT_TSC
+		if (si().use_tsc) return __rdtsc();
+		#endif
+		return (uint64_t)sys_ns();
+	}
+
+	// Перевод разницы счетчика тактов в нс
+	static int64_t cycles_ns(uint64_t cycles) noexcept {
+		if (!si().use_tsc) return (int64_t)cycles;
+		uint64_t m = si().mult;
+		return (int64_t)((cycles >> 32) * m + (((cycles & 0xFFFFFFFF) * m) >> 32));
+	}
+
+	// Монотонное время, нс
+	static int64_t now_ns() noexcept {
+		#ifdef LT_TSC
+		static_info_t& s = si();
+		if (s.use_tsc) return s.ns_start + cycles_ns(__rdtsc() - s.tsc_start);
+		#endif
+		return sys_ns();
+	}
+
+	// Время первого обращения к часам, нс
+	static int64_t start_ns() noexcept {
+		return si().ns_start;
+	}
+
+	// Калибровка заранее, чтобы первое обращение к часам в рабочем потоке не ждало 10 мс
+	static void init() noexcept {
+		si();
+	}
+
+	// Время по TSC
+	static bool is_tsc() noexcept {
+		return si().use_tsc;
+	}
+};
+
+// Монотонное время, нс
+static int64_t lite_time_ns() noexcept {
+	return lite_clock_t::now_ns();
+}
+
+// Счетчик тактов процессора (при отсутствии TSC - нс)
+static uint64_t lite_cycles() noexcept {
+	return lite_clock_t::cycles();
+}
+
+// Перевод разницы lite_cycles() в нс
+static int64_t lite_cycles_ns(uint64_t cycles) noexcept {
+	return lite_clock_t::cycles_ns(cycles);
+}
+
 // Время с момента запуска, мсек
 static int64_t lite_time_now() {
-	static std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
-	std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
-	std::chrono::duration<double> time_span = std::chrono::duration_cast<std::chrono::duration<double>>(t2 - t);
-	return (int64_t)(time_span.count() * 1000);
+	return (lite_time_ns() - lite_clock_t::start_ns()) / 1000000;
+}
+
+// Время с момента запуска, мкс
+static int64_t lite_time_us() noexcept {
+	return (lite_time_ns() - lite_clock_t::start_ns()) / 1000;
 }
 
 //----------------------------------------------------------------------------------
@@ -567,91 +1332,716 @@ class lite_msg_queue_t;
 class lite_timer_t;
 
 static void lite_log(int err, const char* data, ...) noexcept;
+static void lite_log_thread_end() noexcept;
 static size_t lite_thread_num() noexcept;
+static size_t lite_thread_workers() noexcept;
 static void lite_thread_wake_up() noexcept;
 static void lite_timer_run(lite_actor_t* actor, int time_ms) noexcept;
+static void lite_timer_run_us(lite_actor_t* actor, int64_t time_us) noexcept;
 
 //----------------------------------------------------------------------------------
-//-------- СООБЩЕНИE ---------------------------------------------------------------
+//------ ТОПОЛОГИЯ ПРОЦЕССОРОВ -----------------------------------------------------
 //----------------------------------------------------------------------------------
-struct lite_msg_t : public lite_align64_t {
-public:
-	size_t lite_msg_type = {0};		// Тип сообщения
-
-	friend lite_msg_queue_t;
-protected:
-	lite_msg_t* lite_msg_next = {0};	// Указатель на следующее сообщение в очереди
+#define LT_AFFINITY_NONE	0 // Потоки не привязываются к процессорам
+#define LT_AFFINITY_COMPACT	1 // Подряд: сначала заполняются процессоры одного кэша L2, затем L3, затем сокета
+#define LT_AFFINITY_SCATTER	2 // Вразброс: по одному потоку на сокет, кэш L3, кэш L2 по очереди
+#define LT_AFFINITY_LIST	3 // По явному списку процессоров
 
+// Привязка потоков к процессорам и определение процессоров с общим кэшем
+class lite_topology_t {
 public:
+	struct cpu_t {
+		int cpu;		// Номер процессора
+		int package;	// Сокет
+		int l3;			// Домен кэша L3, минимальный номер процессора разделяющего кэш
+		int l2;			// Домен кэша L2
+		int node;		// Узел NUMA
+	};
 
-	lite_msg_t() {}
+private:
+	struct static_info_t : public lite_static_info_t<static_info_t> {
+		std::vector<cpu_t> cpu_list;			// Процессоры в порядке назначения потокам
+		int policy = {LT_AFFINITY_NONE};		// Политика привязки
+		std::vector<int> cpu_node;				// Узел NUMA по номеру процессора
+		int node_count = {1};					// Количество узлов NUMA
+
+		static_info_t() {
+			std::vector<int> nodes = parse_list(read_line("/sys/devices/system/node/online"));
+			for (int node : nodes) {
+				std::vector<int> cpus = parse_list(read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+				for (int cpu : cpus) {
+					if (cpu_node.size() <= (size_t)cpu) cpu_node.resize(cpu + 1, 0);
+					cpu_node[cpu] = node;
+				}
+				if (node_count <= node) node_count = node + 1;
+			}
+		}
+	};
 
-	lite_msg_t(const lite_msg_t& m) {
-		lite_msg_type = m.lite_msg_type;
+	static static_info_t& si() noexcept {
+		return static_info_t::si();
 	}
 
-	virtual ~lite_msg_t(){};
+	// static переменные уровня потока
+	struct thread_info_t : public lite_thread_info_t<thread_info_t> {
+		int node;		// Узел NUMA потока
+		bool node_set;	// Узел определен
+	};
 
-	void *operator new(size_t size) {
-		#ifdef LT_STAT
-		lite_thread_stat_t::ti().stat_msg_create++;
-		#endif
-		return lite_align64_t::operator new(size);
+	static thread_info_t& ti() noexcept {
+		return thread_info_t::tls_get();
 	}
 
-	void operator delete(void *p) {
-		#ifdef LT_STAT
-		lite_thread_stat_t::ti().stat_msg_erase++;
-		#endif
-		lite_align64_t::operator delete(p);
+	// Чтение первой строки файла
+	static std::string read_line(const std::string& path) {
+		std::string ret;
+		FILE* f = fopen(path.c_str(), "r");
+		if (f == NULL) return ret;
+		char buf[256];
+		if (fgets(buf, sizeof(buf), f) != NULL) {
+			ret = buf;
+			while (!ret.empty() && (ret.back() == '\n' || ret.back() == '\r')) ret.pop_back();
+		}
+		fclose(f);
+		return ret;
 	}
 
-	// Установка типа сообщения по классу
-	template <typename T>
-	static void type_set(T* msg) {
-		if(msg->lite_msg_type == 0) msg->lite_msg_type = typeid(T).hash_code();
+	// Разбор списка процессоров вида "0-3,8,10-11"
+	static std::vector<int> parse_list(const std::string& str) {
+		std::vector<int> ret;
+		const char* p = str.c_str();
+		while (*p != 0) {
+			char* end;
+			long from = strtol(p, &end, 10);
+			if (end == p) break;
+			long to = from;
+			p = end;
+			if (*p == '-') {
+				to = strtol(p + 1, &end, 10);
+				p = end;
+			}
+			for (long i = from; i <= to; i++) ret.push_back((int)i);
+			if (*p == ',') p++;
+		}
+		return ret;
+	}
+
+	// Минимальный номер процессора разделяющего кэш уровня level с cpu, -1 если неизвестно
+	static int cache_domain(int cpu, int level) {
+		std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+		for (int i = 0; i < 8; i++) {
+			std::string lv = read_line(dir + std::to_string(i) + "/level");
+			if (lv.empty()) break;
+			if (atoi(lv.c_str()) != level) continue;
+			std::string type = read_line(dir + std::to_string(i) + "/type");
+			if (type == "Instruction") continue;
+			std::vector<int> shared = parse_list(read_line(dir + std::to_string(i) + "/shared_cpu_list"));
+			if (!shared.empty()) return shared[0];
+		}
+		return -1;
+	}
+
+	// Чтение топологии из /sys, при недоступности все процессоры считаются независимыми
+	static std::vector<cpu_t> read_topology() {
+		std::vector<cpu_t> ret;
+		std::vector<int> online = parse_list(read_line("/sys/devices/system/cpu/online"));
+		if (online.empty()) {
+			unsigned int cnt = std::thread::hardware_concurrency();
+			for (unsigned int i = 0; i < (cnt > 0 ? cnt : 1); i++) online.push_back((int)i);
+		}
+		for (int cpu : online) {
+			cpu_t c;
+			c.cpu = cpu;
+			std::string pkg = read_line("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/physical_package_id");
+			c.package = pkg.empty() ? 0 : atoi(pkg.c_str());
+			c.l2 = cache_domain(cpu, 2);
+			if (c.l2 < 0) c.l2 = cpu;
+			c.l3 = cache_domain(cpu, 3);
+			if (c.l3 < 0) c.l3 = c.package;
+			c.node = node_of_cpu(cpu);
+			ret.push_back(c);
+		}
+		return ret;
+	}
+
+	// Порядковый номер значения среди уникальных значений, встретившихся до него
+	static int rank(std::vector<std::pair<int, int> >& seen, int group, int val) {
+		int r = 0;
+		for (auto& s : seen) {
+			if (s.first != group) continue;
+			if (s.second == val) return r;
+			r++;
+		}
+		seen.push_back(std::make_pair(group, val));
+		return r;
+	}
+
+public:
+	// Установка политики привязки. Вызывать до запуска потоков
+	static void policy_set(int policy, const std::vector<int>& list = std::vector<int>()) {
+		std::vector<cpu_t> topo = read_topology();
+		std::vector<cpu_t> order;
+		if (policy == LT_AFFINITY_LIST) {
+			for (int cpu : list) {
+				for (auto& c : topo) {
+					if (c.cpu == cpu) order.push_back(c);
+				}
+			}
+		} else if (policy == LT_AFFINITY_COMPACT || policy == LT_AFFINITY_SCATTER) {
+			order = topo;
+			std::sort(order.begin(), order.end(), [](const cpu_t& a, const cpu_t& b) {
+				if (a.package != b.package) return a.package < b.package;
+				if (a.l3 != b.l3) return a.l3 < b.l3;
+				if (a.l2 != b.l2) return a.l2 < b.l2;
+				return a.cpu < b.cpu;
+			});
+			if (policy == LT_AFFINITY_SCATTER) {
+				// Ключ сортировки: номер внутри L2, номер L2 внутри L3, номер L3 внутри сокета, сокет
+				std::vector<std::pair<int, int> > seen_l2, seen_l3, seen_cpu;
+				std::vector<std::pair<std::vector<int>, cpu_t> > key;
+				for (auto& c : order) {
+					std::vector<int> k;
+					k.push_back(rank(seen_cpu, c.l2, c.cpu));
+					k.push_back(rank(seen_l2, c.l3, c.l2));
+					k.push_back(rank(seen_l3, c.package, c.l3));
+					k.push_back(c.package);
+					key.push_back(std::make_pair(k, c));
+				}
+				std::stable_sort(key.begin(), key.end(), [](const std::pair<std::vector<int>, cpu_t>& a, const std::pair<std::vector<int>, cpu_t>& b) {
+					return a.first < b.first;
+				});
+				order.clear();
+				for (auto& k : key) order.push_back(k.second);
+			}
+		}
+		if (order.empty()) policy = LT_AFFINITY_NONE;
+		si().cpu_list = order;
+		si().policy = policy;
+	}
+
+	// Включена ли привязка
+	static bool is_active() noexcept {
+		return si().policy != LT_AFFINITY_NONE;
+	}
+
+	// Процессор для потока с номером num, NULL если привязки нет
+	static const cpu_t* cpu_get(size_t num) noexcept {
+		if (si().policy == LT_AFFINITY_NONE || num >= 999) return NULL;
+		return &si().cpu_list[num % si().cpu_list.size()];
+	}
+
+	// Потоки a и b используют общий кэш: level 2 - L2, 3 - L3
+	static bool is_near(size_t a, size_t b, int level = 3) noexcept {
+		const cpu_t* ca = cpu_get(a);
+		const cpu_t* cb = cpu_get(b);
+		if (ca == NULL || cb == NULL) return false;
+		return level == 2 ? ca->l2 == cb->l2 : ca->l3 == cb->l3;
+	}
+
+	// Количество узлов NUMA
+	static int node_count() noexcept {
+		return si().node_count;
+	}
+
+	// Узел NUMA процессора
+	static int node_of_cpu(int cpu) noexcept {
+		return (cpu >= 0 && (size_t)cpu < si().cpu_node.size()) ? si().cpu_node[cpu] : 0;
+	}
+
+	// Узел NUMA текущего потока. Для непривязанного потока определяется по процессору при первом вызове
+	static int node_current() noexcept {
+		thread_info_t& t = ti();
+		if (!t.node_set) {
+			#if defined __linux__
+			t.node = node_of_cpu(sched_getcpu());
+			#else
+			t.node = 0;
+			#endif
+			t.node_set = true;
+		}
+		return t.node;
+	}
+
+	// Привязка текущего потока к процессору потока с номером num
+	static void pin(size_t num) noexcept {
+		const cpu_t* c = cpu_get(num);
+		if (c == NULL) return;
+		ti().node = c->node;
+		ti().node_set = true;
+		#if defined LT_WIN
+		if (c->cpu >= (int)(sizeof(DWORD_PTR) * 8)) return; // Процессоры вне первой группы не поддерживаются
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << c->cpu);
+		#elif defined __linux__
+		if (c->cpu >= CPU_SETSIZE) return;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(c->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		#endif
+	}
+
+	// Описание назначения потоков процессорам
+	static std::string descr() {
+		if (si().policy == LT_AFFINITY_NONE) return "affinity none";
+		static const char* names[] = { "none", "compact", "scatter", "list" };
+		std::string ret = "affinity ";
+		ret += names[si().policy];
+		ret += ":";
+		for (size_t i = 0; i < si().cpu_list.size(); i++) {
+			const cpu_t& c = si().cpu_list[i];
+			char buf[128];
+			snprintf(buf, sizeof(buf), " thread#%d->cpu%d(node %d pkg %d L3 %d L2 %d)", (int)i, c.cpu, c.node, c.package, c.l3, c.l2);
+			ret += buf;
+		}
+		return ret;
+	}
+};
+
+// Узел NUMA текущего потока, -1 если узел один
+static int lite_numa_node() noexcept {
+	return lite_topology_t::node_count() > 1 ? lite_topology_t::node_current() : -1;
+}
+
+#ifndef LT_NUMA_SLAB
+#define LT_NUMA_SLAB 0x10000 // Размер страницы пула на узле NUMA
+#endif
+
+// Выделение памяти на узле NUMA, при невозможности привязки обычное выделение
+static void* lite_malloc_node(size_t size, int node) noexcept {
+#ifdef LT_NUMA
+	void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) return NULL;
+	if (node >= 0 && node < 64) {
+		unsigned long mask = 1UL << node;
+		syscall(SYS_mbind, p, size, 1 /* MPOL_PREFERRED */, &mask, sizeof(mask) * 8, 0);
+	}
+	return p;
+#else
+	(void)node;
+	return lite_malloc(size);
+#endif
+}
+
+static void lite_free_node(void* p, size_t size) noexcept {
+#ifdef LT_NUMA
+	munmap(p, size);
+#else
+	(void)size;
+	lite_free(p);
+#endif
+}
+
+//----------------------------------------------------------------------------------
+//-------- ПУЛ ПАМЯТИ СООБЩЕНИЙ ----------------------------------------------------
+//----------------------------------------------------------------------------------
+#ifndef LT_MSG_POOL_CLASS
+#define LT_MSG_POOL_CLASS 64	// Количество размерных классов с шагом 64 байта, т.е. в пуле сообщения до 4 Кб
+#endif
+#ifndef LT_MSG_POOL_SIZE
+#define LT_MSG_POOL_SIZE 1024	// Максимум свободных блоков одного класса в пуле потока
+#endif
+#ifndef LT_MSG_POOL_BATCH
+#define LT_MSG_POOL_BATCH 32	// Размер пачки блоков, возвращаемой в пул другого потока
+#endif
+
+// Пул памяти под сообщения и акторы. У каждого потока свой пул со списками свободных блоков по размерам.
+// Блок освобожденный в чужом потоке накапливается в пачку и пачкой возвращается в пул владельца.
+// При нескольких узлах NUMA блоки нарезаются из страниц LT_NUMA_SLAB, выделенных на узле потока.
+class lite_msg_pool_t {
+	// Заголовок страницы блоков на узле NUMA
+	struct slab_t {
+		std::atomic<size_t> used;	// Количество блоков не возвращенных в систему
+		size_t size;				// Размер страницы
+	};
+
+	// Заголовок блока, располагается перед сообщением
+	struct block_t {
+		lite_msg_pool_t* owner;	// Пул, выделивший блок. NULL - блок выделен вне пула
+		size_t size_class;		// Размерный класс
+		block_t* next;			// Следующий в списке свободных
+		slab_t* slab;			// Страница блока на узле NUMA. NULL - блок выделен lite_malloc()
+		int node;				// Узел NUMA блока, -1 если узел один
+	};
+	static const size_t header_size = 0x40; // Размер заголовка, сохраняет выравнивание сообщения
+
+	block_t* free_list[LT_MSG_POOL_CLASS];	// Свободные блоки
+	size_t free_count[LT_MSG_POOL_CLASS];	// Количество свободных блоков
+	std::atomic<block_t*> remote;			// Блоки возвращенные другими потоками
+	lite_msg_pool_t* batch_owner;			// Владелец блоков накопленной пачки
+	block_t* batch_first;					// Пачка блоков для возврата владельцу
+	block_t* batch_last;
+	size_t batch_count;
+	lite_msg_pool_t* pool_next;				// Следующий в списке неиспользуемых пулов
+	int node;								// Узел NUMA пула, -1 если узел один
+
+	lite_msg_pool_t(int node) : remote(NULL), batch_owner(NULL), batch_first(NULL), batch_last(NULL), batch_count(0), pool_next(NULL), node(node) {
+		memset(free_list, 0, sizeof(free_list));
+		memset(free_count, 0, sizeof(free_count));
+	}
+
+	// Возврат блока в систему
+	static void block_free(block_t* b) noexcept {
+		slab_t* slab = b->slab;
+		if (slab == NULL) {
+			lite_free(b);
+		} else if (slab->used.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			lite_free_node(slab, slab->size);
+		}
+	}
+
+	// Нарезка страницы на узле пула в блоки класса size_class. Возвращает один блок, остальные в свободные
+	block_t* slab_alloc(size_t size_class) noexcept {
+		size_t block_size = header_size + ((size_class + 1) << 6);
+		size_t count = (LT_NUMA_SLAB - 0x40) / block_size; // Заголовок страницы занимает кэшлинию
+		if (count == 0) return NULL;
+		slab_t* slab = (slab_t*)lite_malloc_node(LT_NUMA_SLAB, node);
+		if (slab == NULL) return NULL;
+		slab->size = LT_NUMA_SLAB;
+		slab->used = count;
+		uint8_t* p = (uint8_t*)slab + 0x40;
+		block_t* ret = NULL;
+		for (size_t i = 0; i < count; i++, p += block_size) {
+			block_t* b = (block_t*)p;
+			b->owner = this;
+			b->size_class = size_class;
+			b->slab = slab;
+			b->node = node;
+			if (ret == NULL) {
+				ret = b;
+			} else {
+				free_push(b);
+			}
+		}
+		return ret;
+	}
+
+	// Помещение в список свободных, при переполнении возврат в систему
+	void free_push(block_t* b) noexcept {
+		if (free_count[b->size_class] < LT_MSG_POOL_SIZE) {
+			b->next = free_list[b->size_class];
+			free_list[b->size_class] = b;
+			free_count[b->size_class]++;
+		} else {
+			block_free(b);
+		}
+	}
+
+	// Перенос возвращенных другими потоками блоков в списки свободных
+	bool remote_take() noexcept {
+		if (remote.load(std::memory_order_relaxed) == NULL) return false;
+		block_t* b = remote.exchange(NULL, std::memory_order_acquire);
+		while (b != NULL) {
+			block_t* next = b->next;
+			free_push(b);
+			b = next;
+		}
+		return true;
+	}
+
+	// Возврат накопленной пачки владельцу
+	void batch_flush() noexcept {
+		if (batch_first == NULL) return;
+		block_t* head = batch_owner->remote.load(std::memory_order_relaxed);
+		do {
+			batch_last->next = head;
+		} while (!batch_owner->remote.compare_exchange_weak(head, batch_first, std::memory_order_release, std::memory_order_relaxed));
+		batch_owner = NULL;
+		batch_first = NULL;
+		batch_last = NULL;
+		batch_count = 0;
+	}
+
+	// Добавление блока чужого пула в пачку
+	void batch_push(block_t* b) noexcept {
+		if (batch_owner != b->owner) {
+			batch_flush();
+			batch_owner = b->owner;
+		}
+		b->next = batch_first;
+		batch_first = b;
+		if (batch_last == NULL) batch_last = b;
+		if (++batch_count >= LT_MSG_POOL_BATCH) batch_flush();
+	}
+
+	// Освобождение всех свободных блоков
+	void trim() noexcept {
+		remote_take();
+		for (size_t i = 0; i < LT_MSG_POOL_CLASS; i++) {
+			while (free_list[i] != NULL) {
+				block_t* b = free_list[i];
+				free_list[i] = b->next;
+				block_free(b);
+			}
+			free_count[i] = 0;
+		}
 	}
 
-private:
 	// static переменные глобальные ----------------------------------------------------
-	typedef std::unordered_map<size_t, std::string> type_name_idx_t;
+	struct static_info_t : public lite_static_info_t<static_info_t> {
+		lite_msg_pool_t* pool_free = {0};	// Пулы завершившихся потоков
+		lite_mutex_t mtx;					// Блокировка доступа к pool_free
+	};
+
+	static static_info_t& si() noexcept {
+		return static_info_t::si();
+	}
+
+	// static переменные уровня потока -------------------------------------------------
+	struct thread_info_t : public lite_thread_info_t<thread_info_t> {
+		lite_msg_pool_t* pool;	// Пул потока
+		bool is_end;			// Поток завершается, пул уже возвращен
+
+		~thread_info_t() {
+			release();
+		}
+
+		// Возврат пула в список неиспользуемых
+		void release() noexcept {
+			if (pool == NULL) return;
+			pool->batch_flush();
+			lite_lock_t lck(si().mtx);
+			pool->pool_next = si().pool_free;
+			si().pool_free = pool;
+			pool = NULL;
+			is_end = true;
+		}
+	};
+
+	static thread_info_t& ti() noexcept {
+		return thread_info_t::tls_get();
+	}
+
+	// Пул текущего потока. NULL если поток завершается
+	static lite_msg_pool_t* pool_get() noexcept {
+		thread_info_t& t = ti();
+		if (t.pool == NULL && !t.is_end) {
+			int node = lite_numa_node();
+			{ // Неиспользуемый пул того же узла NUMA
+				lite_lock_t lck(si().mtx);
+				for (lite_msg_pool_t** pp = &si().pool_free; *pp != NULL; pp = &(*pp)->pool_next) {
+					if ((*pp)->node != node) continue;
+					t.pool = *pp;
+					*pp = t.pool->pool_next;
+					break;
+				}
+			}
+			if (t.pool == NULL) t.pool = new lite_msg_pool_t(node);
+		}
+		return t.pool;
+	}
+
+public:
+	// Выделение памяти
+	static void* alloc(size_t size) noexcept {
+		size_t size_class = (size - 1) >> 6;
+		lite_msg_pool_t* pool = (size_class < LT_MSG_POOL_CLASS ? pool_get() : NULL);
+		block_t* b = NULL;
+		if (pool != NULL) {
+			b = pool->free_list[size_class];
+			if (b == NULL && pool->remote_take()) b = pool->free_list[size_class];
+			if (b != NULL) {
+				pool->free_list[size_class] = b->next;
+				pool->free_count[size_class]--;
+				#ifdef LT_STAT
+				lite_thread_stat_t::ti().stat_pool_hit++;
+				#endif
+				return (uint8_t*)b + header_size;
+			}
+			size = (size_class + 1) << 6;
+		}
+		#ifdef LT_STAT
+		lite_thread_stat_t::ti().stat_pool_miss++;
+		#endif
+		if (pool != NULL && pool->node >= 0) {
+			b = pool->slab_alloc(size_class);
+			if (b != NULL) return (uint8_t*)b + header_size;
+		}
+		b = (block_t*)lite_malloc(size + header_size);
+		if (b == NULL) return NULL;
+		b->owner = pool;
+		b->size_class = size_class;
+		b->slab = NULL;
+		b->node = (pool != NULL ? pool->node : lite_numa_node());
+		return (uint8_t*)b + header_size;
+	}
 
+	// Узел NUMA на котором выделена память, -1 если узел один
+	static int node_of(const void* p) noexcept {
+		return ((const block_t*)((const uint8_t*)p - header_size))->node;
+	}
+
+	// Освобождение памяти
+	static void free(void* p) noexcept {
+		if (p == NULL) return;
+		block_t* b = (block_t*)((uint8_t*)p - header_size);
+		if (b->owner == NULL) {
+			block_free(b);
+			return;
+		}
+		lite_msg_pool_t* pool = pool_get();
+		if (pool == b->owner) {
+			pool->free_push(b);
+		} else if (pool != NULL) {
+			pool->batch_push(b);
+		} else { // Поток завершается, возврат владельцу сразу
+			block_t* head = b->owner->remote.load(std::memory_order_relaxed);
+			do {
+				b->next = head;
+			} while (!b->owner->remote.compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+		}
+	}
+
+	// Извещение о завершении потока
+	static void thread_end() noexcept {
+		ti().release();
+		thread_info_t::tls_free();
+	}
+
+	// Возврат в систему памяти неиспользуемых пулов и пула текущего потока
+	static void clear() noexcept {
+		lite_msg_pool_t* pool = ti().pool;
+		if (pool != NULL) {
+			pool->batch_flush();
+			pool->trim();
+		}
+		lite_lock_t lck(si().mtx);
+		for (pool = si().pool_free; pool != NULL; pool = pool->pool_next) {
+			pool->trim();
+		}
+	}
+};
+
+//----------------------------------------------------------------------------------
+//-------- СООБЩЕНИE ---------------------------------------------------------------
+//----------------------------------------------------------------------------------
+#define LT_MSG_ENVELOPE 0x80000000u	// Признак конверта общего сообщения в lite_msg_refs
+
+struct lite_msg_t : public lite_align64_t {
+public:
+	uint32_t lite_msg_type = {0};		// Тип сообщения
+
+	friend lite_msg_queue_t;
+	friend lite_actor_t;
+	friend struct lite_msg_env_t;
+protected:
+	std::atomic<uint32_t> lite_msg_refs = {0};	// Общее сообщение: количество конвертов, у конверта LT_MSG_ENVELOPE
+	lite_msg_t* lite_msg_next = {0};	// Указатель на следующее сообщение в очереди
+	#ifdef LT_STAT
+	int64_t lite_msg_time = {0};		// Время постановки в очередь, нс
+	#endif
+
+public:
+
+	lite_msg_t() {}
+
+	lite_msg_t(const lite_msg_t& m) {
+		lite_msg_type = m.lite_msg_type;
+	}
+
+	lite_msg_t& operator=(const lite_msg_t& m) {
+		lite_msg_type = m.lite_msg_type;
+		return *this;
+	}
+
+	virtual ~lite_msg_t(){};
+
+	void *operator new(size_t size) {
+		#ifdef LT_STAT
+		lite_thread_stat_t::ti().stat_msg_create++;
+		#endif
+		void* p = lite_msg_pool_t::alloc(size);
+		if (p == NULL) {
+			assert(p != NULL);
+			throw std::bad_alloc();
+		}
+		return p;
+	}
+
+	void operator delete(void *p) {
+		#ifdef LT_STAT
+		lite_thread_stat_t::ti().stat_msg_erase++;
+		#endif
+		lite_msg_pool_t::free(p);
+	}
+
+	// Установка типа сообщения по классу
+	template <typename T>
+	static void type_set(T* msg) noexcept {
+		if(msg->lite_msg_type == 0) msg->lite_msg_type = (uint32_t)type_get<T>();
+	}
+
+	// Сообщение общее, изменять нельзя
+	bool is_shared() const noexcept {
+		uint32_t r = lite_msg_refs.load(std::memory_order_relaxed);
+		return r != 0 && (r & LT_MSG_ENVELOPE) == 0;
+	}
+
+private:
+	// static переменные глобальные ----------------------------------------------------
 	struct static_info_t : public lite_static_info_t<static_info_t> {
-		type_name_idx_t tn_idx; // Список типов
-		lite_mutex_t mtx;		// Блокировка для доступа к tn_idx
+		std::vector<std::string> tn_list;	// Названия типов по номеру, для диагностики
+		lite_mutex_t mtx;					// Блокировка для доступа к tn_list
 	};
 
 	static static_info_t& si() noexcept {
 		return static_info_t::si();
 	}
 
+	// Назначение номера новому типу
+	static size_t type_register(const char* name) noexcept {
+		lite_lock_t lck(si().mtx); // Блокировка
+		si().tn_list.push_back(name);
+		return si().tn_list.size(); // Номера с 1, 0 - тип не установлен
+	}
+
 public:
-	// Вывод типа сообщения
+	// Номер типа сообщения. Номера плотные, назначаются один раз при первом обращении к типу,
+	// дальше без блокировок
 	template <typename T>
 	static size_t type_get() noexcept {
-		size_t hash = typeid(T).hash_code();
-		lite_lock_t lck(si().mtx); // Блокировка
-		// Сохранение названия типа
-		if (si().tn_idx.find(hash) == si().tn_idx.end()) {
-			si().tn_idx[hash] = typeid(T).name();
-		}
-		return hash;
+		static const size_t id = type_register(typeid(T).name());
+		return id;
 	}
 
 	// Тип сообщения строкой
 	const std::string type_descr() {
 		lite_lock_t lck(si().mtx); // Блокировка
-		type_name_idx_t::iterator it = si().tn_idx.find(lite_msg_type);
-		if (it == si().tn_idx.end()) {
+		if (lite_msg_type == 0 || lite_msg_type > si().tn_list.size()) {
 			std::string t = "type#";
 			t += std::to_string(lite_msg_type);
 			return t;
 		} else {
-			return it->second;
+			return si().tn_list[lite_msg_type - 1];
 		}
 	}
 };
 
+// Конверт общего сообщения: ставится в очередь вместо него, удаляется после обработки и
+// освобождает ссылку. Общее сообщение удаляется вместе с последним конвертом
+struct lite_msg_env_t : public lite_msg_t {
+	lite_msg_t* payload;
+
+	lite_msg_env_t(lite_msg_t* msg) : payload(msg) {
+		lite_msg_type = msg->lite_msg_type;
+		lite_msg_refs = LT_MSG_ENVELOPE;
+	}
+
+	~lite_msg_env_t() {
+		if (payload->lite_msg_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete payload;
+	}
+
+	// Конверт для дополнительного получателя общего сообщения
+	static lite_msg_t* wrap(lite_msg_t* msg) noexcept {
+		msg->lite_msg_refs.fetch_add(1, std::memory_order_relaxed);
+		return new lite_msg_env_t(msg);
+	}
+
+	// Сообщение для обработчика: из конверта или само сообщение
+	static lite_msg_t* open(lite_msg_t* msg) noexcept {
+		return (msg->lite_msg_refs.load(std::memory_order_relaxed) & LT_MSG_ENVELOPE) ? static_cast<lite_msg_env_t*>(msg)->payload : msg;
+	}
+};
+
 //----------------------------------------------------------------------------------
 //-------- ОЧЕРЕДЬ СООБЩЕНИЙ -------------------------------------------------------
 //----------------------------------------------------------------------------------
@@ -661,12 +2051,13 @@ class lite_msg_queue_t {
 	lite_msg_t* msg_first2;			// Указатель на первое в очереди, меняется только под блокировкой
 	lite_msg_t* msg_last;			// Указатель на последнее в очереди
 	lite_mutex_t mtx;				// Синхронизация доступа
+	size_t pop_seq;					// Номер следующего извлекаемого сообщения, для упорядочивания
 	#ifdef LT_STAT_QUEUE
 	std::atomic<size_t> size;		// Размер очереди
 	#endif
 
 public:
-	lite_msg_queue_t() : msg_first(NULL), msg_first2(NULL), msg_last(NULL) {
+	lite_msg_queue_t() : msg_first(NULL), msg_first2(NULL), msg_last(NULL), pop_seq(0) {
 		#ifdef LT_STAT_QUEUE
 		size = 0;
 		#endif
@@ -689,8 +2080,27 @@ public:
 		#endif
 	}
 
-	// Чтение сообщения из очереди. lock = false без блокировки использовать msg_first
-	lite_msg_t* pop(bool lock = true) noexcept {
+	// Добавление цепочки сообщений first..last, связанных через lite_msg_next, за одну блокировку
+	void push_chain(lite_msg_t* first, lite_msg_t* last, size_t count) noexcept {
+		last->lite_msg_next = NULL;
+		lite_lock_t lck(mtx); // Блокировка
+		if(msg_last == NULL) {
+			msg_first2 = first;
+		} else {
+			msg_last->lite_msg_next = first;
+		}
+		msg_last = last;
+		#ifdef LT_STAT_QUEUE
+		size += count;
+		if (lite_thread_stat_t::ti().stat_queue_max < size) lite_thread_stat_t::ti().stat_queue_max = size;
+		#else
+		(void)count;
+		#endif
+	}
+
+	// Чтение сообщения из очереди. lock = false без блокировки использовать msg_first.
+	// seq != NULL - получение номера сообщения в порядке извлечения
+	lite_msg_t* pop(bool lock = true, size_t* seq = NULL) noexcept {
 		if (lock) {
 			mtx.lock(); // Блокировка
 		}
@@ -714,6 +2124,7 @@ public:
 				msg_first = msg->lite_msg_next; // Повторное чтение под блокировкой на случай если был push
 				if(msg_first == NULL) msg_last = NULL;
 			}
+			if (seq != NULL) *seq = pop_seq++;
 		}
 		if (lock) mtx.unlock(); // Снятие блокировки
 
@@ -729,30 +2140,195 @@ public:
 	int empty() noexcept {
 		return msg_last == NULL;
 	}
+
+	// Проверка пустоты под блокировкой, для синхронизации с push()
+	bool empty_locked() noexcept {
+		lite_lock_t lck(mtx);
+		return msg_last == NULL;
+	}
 };
 
 //----------------------------------------------------------------------------------
-//------ КЭШ АКТОРОВ ГОТОВЫХ К ВЫПОЛНЕНИЮ ------------------------------------------
+//------ КЭШ АКТОРОВ ОЖИДАЮЩИХ РЕСУРС ----------------------------------------------
 //----------------------------------------------------------------------------------
+#ifndef LT_ACTOR_CACHE_SIZE
+#define LT_ACTOR_CACHE_SIZE 64 // Размер кольцевого буфера кэша, степень 2
+#endif
+
+// Кольцевой буфер без блокировок, при переполнении запись в список под блокировкой. Порядок FIFO.
 class lite_actor_cache_t {
-	std::atomic<lite_actor_t*> next = {0};
+	struct cell_t {
+		std::atomic<size_t> seq;		// Номер позиции, по которому ячейка доступна для записи/чтения
+		std::atomic<lite_actor_t*> la;	// Актор, NULL - удален
+	};
+
+	cell_t ring[LT_ACTOR_CACHE_SIZE];		// Кольцевой буфер
+	std::atomic<size_t> pos_push = {0};		// Позиция записи
+	std::atomic<size_t> pos_pop = {0};		// Позиция чтения
+	std::deque<lite_actor_t*> overflow;		// Не поместившиеся в кольцевой буфер
+	std::atomic<size_t> overflow_size = {0};// Количество в overflow
+	lite_mutex_t mtx;						// Блокировка доступа к overflow
+
+	// Запись в кольцевой буфер, false если заполнен
+	bool ring_push(lite_actor_t* la) noexcept {
+		size_t pos = pos_push.load(std::memory_order_relaxed);
+		while (true) {
+			cell_t& c = ring[pos & (LT_ACTOR_CACHE_SIZE - 1)];
+			size_t seq = c.seq.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+			if (dif == 0) {
+				if (pos_push.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					c.la.store(la, std::memory_order_relaxed);
+					c.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false; // Буфер заполнен
+			} else {
+				pos = pos_push.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Чтение из кольцевого буфера, false если пуст. В la может быть NULL если запись удалена
+	bool ring_pop(lite_actor_t*& la) noexcept {
+		size_t pos = pos_pop.load(std::memory_order_relaxed);
+		while (true) {
+			cell_t& c = ring[pos & (LT_ACTOR_CACHE_SIZE - 1)];
+			size_t seq = c.seq.load(std::memory_order_acquire);
+			intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+			if (dif == 0) {
+				if (pos_pop.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					la = c.la.exchange(NULL, std::memory_order_relaxed);
+					c.seq.store(pos + LT_ACTOR_CACHE_SIZE, std::memory_order_release);
+					return true;
+				}
+			} else if (dif < 0) {
+				return false; // Буфер пуст
+			} else {
+				pos = pos_pop.load(std::memory_order_relaxed);
+			}
+		}
+	}
 
 public:
+	lite_actor_cache_t() {
+		for (size_t i = 0; i < LT_ACTOR_CACHE_SIZE; i++) {
+			ring[i].seq = i;
+			ring[i].la = NULL;
+		}
+	}
+
 	// Запись в кэш
 	void push(lite_actor_t* la) noexcept {
-		if(next == (lite_actor_t*)NULL) {
-			lite_actor_t* nul = NULL;
-			if (next.compare_exchange_weak(nul, la)) return;
-		}
+		// Пока есть переполнение запись туда же, для сохранения порядка
+		if (overflow_size == 0 && ring_push(la)) return;
 		#ifdef LT_STAT
 		lite_thread_stat_t::ti().stat_cache_full++;
 		#endif	
+		lite_lock_t lck(mtx);
+		overflow.push_back(la);
+		overflow_size++;
 	}
 
 	// Извлечение из кэша
 	lite_actor_t* pop() noexcept {
-		if(next == (lite_actor_t*)NULL) return NULL;
-		return next.exchange(NULL);
+		lite_actor_t* la = NULL;
+		while (ring_pop(la)) {
+			if (la != NULL) return la;
+		}
+		if (overflow_size == 0) return NULL;
+		lite_lock_t lck(mtx);
+		if (overflow.empty()) return NULL;
+		la = overflow.front();
+		overflow.pop_front();
+		overflow_size--;
+		return la;
+	}
+
+	// Удаление всех вхождений la, возвращает количество удаленных
+	size_t remove(lite_actor_t* la) noexcept {
+		size_t cnt = 0;
+		for (size_t i = 0; i < LT_ACTOR_CACHE_SIZE; i++) {
+			lite_actor_t* l = la;
+			if (ring[i].la.compare_exchange_strong(l, NULL)) cnt++;
+		}
+		lite_lock_t lck(mtx);
+		for (std::deque<lite_actor_t*>::iterator it = overflow.begin(); it != overflow.end();) {
+			if (*it == la) {
+				it = overflow.erase(it);
+				overflow_size--;
+				cnt++;
+			} else {
+				++it;
+			}
+		}
+		return cnt;
+	}
+};
+
+//----------------------------------------------------------------------------------
+//------ ОЧЕРЕДЬ АКТОРОВ ГОТОВЫХ К ВЫПОЛНЕНИЮ --------------------------------------
+//----------------------------------------------------------------------------------
+// У каждого потока своя очередь. Поток берет акторы из начала своей очереди, при ее
+// опустошении забирает с конца очереди другого потока.
+class alignas(64) lite_ready_queue_t {
+	std::deque<lite_actor_t*> queue;	// Акторы готовые к выполнению
+	std::atomic<size_t> count = {0};	// Размер очереди, для проверки без блокировки
+	lite_mutex_t mtx;					// Блокировка доступа к queue
+
+public:
+	// Добавление в конец
+	void push(lite_actor_t* la) noexcept {
+		lite_lock_t lck(mtx);
+		queue.push_back(la);
+		count++;
+	}
+
+	// Извлечение из начала, для своего потока
+	lite_actor_t* pop() noexcept {
+		if (count == 0) return NULL;
+		lite_lock_t lck(mtx);
+		if (queue.empty()) return NULL;
+		lite_actor_t* la = queue.front();
+		queue.pop_front();
+		count--;
+		return la;
+	}
+
+	// Извлечение с конца, для чужого потока
+	lite_actor_t* steal() noexcept {
+		if (count == 0) return NULL;
+		lite_lock_t lck(mtx);
+		if (queue.empty()) return NULL;
+		lite_actor_t* la = queue.back();
+		queue.pop_back();
+		count--;
+		return la;
+	}
+
+	// Удаление всех вхождений la, возвращает количество удаленных
+	size_t remove(lite_actor_t* la) noexcept {
+		if (count == 0) return 0;
+		lite_lock_t lck(mtx);
+		size_t cnt = 0;
+		for (std::deque<lite_actor_t*>::iterator it = queue.begin(); it != queue.end();) {
+			if (*it == la) {
+				it = queue.erase(it);
+				count--;
+				cnt++;
+			} else {
+				++it;
+			}
+		}
+		return cnt;
+	}
+
+	// Очистка
+	void clear() noexcept {
+		lite_lock_t lck(mtx);
+		queue.clear();
+		count = 0;
 	}
 };
 
@@ -770,7 +2346,7 @@ private:
 	std::string name;			// Название ресурса
 
 public:
-	lite_actor_cache_t la_cache;
+	lite_actor_cache_t la_cache;		// Акторы ожидающие освобождения ресурса
 
 	lite_resource_t() {
 		res_free = LT_RESOURCE_DEFAULT;
@@ -866,52 +2442,415 @@ public:
 
 //----------------------------------------------------------------------------------
 //------ ОБРАБОТЧИК (АКТОР) --------------------------------------------------------
+//----------------------------------------------------------------------------------
+//------ ИНДЕКС ИМЕН АКТОРОВ -------------------------------------------------------
+//----------------------------------------------------------------------------------
+// Поиск без блокировок: изменения делаются в копии, которая затем публикуется (RCU). Старая копия
+// удаляется, когда ее не читает ни один поток, читающий поток отмечает копию в своем указателе
+// опасности. Изменения выполняются под блокировкой вызывающего. Экземпляр один на программу.
+class lite_name_index_t {
+	typedef std::unordered_map<std::string, lite_actor_t*> map_t;
+
+	struct slot_t : public lite_align64_t { // Указатель опасности потока
+		std::atomic<map_t*> map = {0};		// Читаемая копия
+		std::atomic<bool> used = {0};		// Занят потоком
+		slot_t* next = {0};
+	};
+
+	struct thread_info_t : public lite_thread_info_t<thread_info_t> {
+		slot_t* slot = {0};
+
+		~thread_info_t() {
+			if (slot != NULL) slot->used = false; // Освобождение для других потоков
+		}
+	};
+
+	std::atomic<map_t*> map;			// Текущая копия
+	std::atomic<size_t> gen;			// Номер изменения
+	std::atomic<slot_t*> slot_list;		// Указатели опасности, только добавляются
+	std::vector<map_t*> retired;		// Замененные копии, ожидающие удаления
+
+	// Указатель опасности текущего потока
+	slot_t* slot_get() {
+		thread_info_t& t = thread_info_t::tls_get();
+		if (t.slot != NULL) return t.slot;
+		for (slot_t* s = slot_list; s != NULL; s = s->next) {
+			bool used = false;
+			if (!s->used && s->used.compare_exchange_strong(used, true)) {
+				t.slot = s;
+				return s;
+			}
+		}
+		slot_t* s = new slot_t();
+		s->used = true;
+		s->next = slot_list;
+		while (!slot_list.compare_exchange_weak(s->next, s));
+		t.slot = s;
+		return s;
+	}
+
+	// Замена текущей копии
+	void publish(map_t* m) {
+		retired.push_back(map.exchange(m));
+		gen++;
+		// Удаление копий, которые никто не читает
+		for (size_t i = 0; i < retired.size(); ) {
+			bool busy = false;
+			for (slot_t* s = slot_list; s != NULL && !busy; s = s->next) busy = (s->map == retired[i]);
+			if (busy) {
+				i++;
+			} else {
+				delete retired[i];
+				retired[i] = retired.back();
+				retired.pop_back();
+			}
+		}
+	}
+
+public:
+	lite_name_index_t() : map(new map_t()), gen(0), slot_list(NULL) {}
+
+	~lite_name_index_t() {
+		delete map.load();
+		for (auto& m : retired) delete m;
+		slot_t* s = slot_list;
+		while (s != NULL) {
+			slot_t* next = s->next;
+			delete s;
+			s = next;
+		}
+	}
+
+	// Поиск, NULL если нет
+	lite_actor_t* find(const std::string& name) {
+		slot_t* s = slot_get();
+		map_t* m;
+		do {
+			m = map;
+			s->map = m;
+		} while (m != map); // Копия не заменена до установки указателя опасности
+		lite_actor_t* la = NULL;
+		map_t::iterator it = m->find(name);
+		if (it != m->end()) la = it->second;
+		s->map.store(NULL, std::memory_order_release);
+		return la;
+	}
+
+	// Добавление, под блокировкой. Возвращает актор, уже зарегистрированный под этим именем, иначе NULL
+	lite_actor_t* insert(const std::string& name, lite_actor_t* la) {
+		map_t* m = map;
+		map_t::iterator it = m->find(name);
+		if (it != m->end()) return it->second;
+		m = new map_t(*m);
+		(*m)[name] = la;
+		publish(m);
+		return NULL;
+	}
+
+	// Удаление, под блокировкой
+	void erase(const std::string& name) {
+		map_t* m = map;
+		if (m->find(name) == m->end()) return;
+		m = new map_t(*m);
+		m->erase(name);
+		publish(m);
+	}
+
+	bool empty() const noexcept {
+		return map.load()->empty();
+	}
+
+	// Номер изменения индекса, для проверки закэшированных результатов поиска
+	size_t generation() const noexcept {
+		return gen.load(std::memory_order_acquire);
+	}
+};
+
+//----------------------------------------------------------------------------------
+// Кольцо упорядочивания обработанных сообщений многопоточного актора (order_set)
+struct lite_order_ring_t : public lite_align64_t {
+	std::atomic<lite_msg_t*> ring[LT_ORDER_RING];	// Обработанные сообщения по номеру, NULL - еще не обработано
+	std::atomic<size_t> head;		// Номер следующего к отправке
+	std::atomic<bool> busy;			// Отправку выполняет один поток
+	lite_actor_t* next;				// Получатель упорядоченных сообщений
+
+	lite_order_ring_t(lite_actor_t* next_) : head(0), busy(false), next(next_) {
+		static_assert((LT_ORDER_RING & (LT_ORDER_RING - 1)) == 0, "LT_ORDER_RING must be a power of 2");
+		for (size_t i = 0; i < LT_ORDER_RING; i++) ring[i] = NULL;
+	}
+
+	// Отметка номера, сообщение которого исключено из порядка
+	static lite_msg_t* skip() noexcept {
+		return (lite_msg_t*)(uintptr_t)1;
+	}
+
+	std::atomic<lite_msg_t*>& slot(size_t seq) noexcept {
+		return ring[seq & (LT_ORDER_RING - 1)];
+	}
+};
+
 //----------------------------------------------------------------------------------
 // Актор (обработчик + очередь сообщений)
 class lite_actor_t : public lite_align64_t {
 
 	lite_resource_t* resource;			// Ресурс, используемый актором
-	lite_msg_queue_t msg_queue;			// Очередь сообщений
+	lite_msg_queue_t msg_queue;			// Очередь сообщений обычного приоритета
+	std::atomic<lite_msg_queue_t*> lanes[LT_PRIO_LANES]; // Очереди по приоритетам, кроме обычной создаются при первом использовании
+	std::atomic<bool> lanes_used;		// Используются очереди кроме обычной
+	std::atomic<int> lane_skip[LT_PRIO_LANES]; // Сколько раз непустая очередь пропущена ради высших приоритетов
+	std::vector<uint8_t> type_prio;		// Приоритет + 1 по номеру типа сообщения, 0 - обычный
+	size_t msg_capacity;				// Ограничение очереди, 0 - без ограничения
+	std::atomic<size_t> msg_count;		// Сообщений в очереди, считается только при ограничении
+	bool fuse;							// Прямой вызов из обработчика отправителя
+	lite_order_ring_t* order;			// Упорядочивание обработанных сообщений, NULL - без упорядочивания
 	std::atomic<int> actor_free;		// Количество свободных акторов, т.е. сколько можно запускать
 	std::atomic<int> thread_max;		// Количество потоков, в скольки можно одновременно выполнять
-	bool in_cache;						// Помещен в кэш планирования запуска
-	bool timer_run;						// Требуется запуск обработки сигнала таймера
+	std::atomic<int> sched;				// Количество постановок в очереди готовых к выполнению, включая выполняющиеся
+	std::atomic<bool> timer_run;		// Требуется запуск обработки сигнала таймера
+	int batch_max;						// Размер пачки сообщений для recv_batch()
+	int home;							// Очередь готовых к выполнению для постановки, -1 - очередь потока-отправителя
 	std::string name;					// Наименование актора
+	#ifdef LT_STAT
+	std::atomic<int> stat_key;			// Номер группы гистограмм задержек, -2 еще не определен
+	#endif
 
-	std::vector<size_t> type_list;		// Список обрабатываемых типов
+	std::vector<uint64_t> type_mask;	// Битовая маска обрабатываемых типов по номеру типа
 
 	friend lite_thread_t;
+	friend class lite_for_actor_t;
 protected:
 	//---------------------------------
 	// Конструктор
-	lite_actor_t() : actor_free(1), thread_max(1), in_cache(false), timer_run(false) {
+	lite_actor_t() : actor_free(1), thread_max(1), sched(0), timer_run(false), batch_max(1) {
 		if(si().res_default == NULL) {
 			si().res_default = lite_resource_manage_t::get("CPU", LT_RESOURCE_DEFAULT);
 		}
 		resource = si().res_default;
+		for (int i = 0; i < LT_PRIO_LANES; i++) {
+			lanes[i] = NULL;
+			lane_skip[i] = 0;
+		}
+		lanes[LT_PRIO_NORMAL] = &msg_queue;
+		lanes_used = false;
+		msg_capacity = 0;
+		msg_count = 0;
+		fuse = false;
+		order = NULL;
+		home = -1;
+		#ifdef LT_STAT
+		stat_key = -2;
+		#endif
 		list_add(this);
 	}
 
-	// Проверка готовности к запуску
-	bool is_ready() noexcept {
-		return ((!msg_queue.empty() || timer_run) && actor_free > 0 && (resource == NULL || resource == ti().lr_now_used || resource->is_free()));
+	// Очередь приоритета prio
+	lite_msg_queue_t* lane_get(int prio) noexcept {
+		lite_msg_queue_t* q = lanes[prio].load(std::memory_order_acquire);
+		if (q == NULL) {
+			lite_msg_queue_t* q_new = new lite_msg_queue_t();
+			if (lanes[prio].compare_exchange_strong(q, q_new)) {
+				q = q_new;
+				lanes_used = true;
+			} else {
+				delete q_new;
+			}
+		}
+		return q;
 	}
 
-	// Постановка сообщения в очередь
-	void push(lite_msg_t* msg) noexcept {
+	// Приоритет отправки: заданный prio или по типу сообщения при prio < 0
+	int prio_get(lite_msg_t* msg, int prio) noexcept {
+		if (order != NULL) return LT_PRIO_NORMAL; // Номера сообщений ведутся по одной очереди
+		if (prio < 0) {
+			size_t t = msg->lite_msg_type;
+			prio = (t < type_prio.size() && type_prio[t] != 0 ? type_prio[t] - 1 : LT_PRIO_NORMAL);
+		}
+		return prio < LT_PRIO_LANES ? prio : LT_PRIO_LOW;
+	}
+
+	// Все очереди пусты
+	bool queue_empty() noexcept {
+		if (!lanes_used) return msg_queue.empty() != 0;
+		for (int i = 0; i < LT_PRIO_LANES; i++) {
+			lite_msg_queue_t* q = lanes[i];
+			if (q != NULL && !q->empty()) return false;
+		}
+		return true;
+	}
+
+	// Проверка пустоты под блокировкой, для синхронизации с push()
+	bool queue_empty_locked() noexcept {
+		for (int i = 0; i < LT_PRIO_LANES; i++) {
+			lite_msg_queue_t* q = lanes[i];
+			if (q != NULL && !q->empty_locked()) return false;
+		}
+		return true;
+	}
+
+	// Извлечение сообщения с учетом ограничения очереди. seq - номер сообщения при упорядочивании
+	lite_msg_t* queue_pop(bool lock, size_t* seq) noexcept {
+		lite_msg_t* msg = (lanes_used.load(std::memory_order_relaxed) ? lanes_pop(lock) : msg_queue.pop(lock, seq));
+		if (msg != NULL && msg_capacity != 0) msg_count.fetch_sub(1, std::memory_order_relaxed);
+		return msg;
+	}
+
+	// Извлечение сообщения, сначала из очереди высшего приоритета. Непустая очередь, пропущенная
+	// LT_PRIO_AGING раз, обслуживается вне очереди
+	lite_msg_t* lanes_pop(bool lock) noexcept {
+		int first = -1;	// Высший непустой приоритет
+		int aged = -1;	// Дольше всех ожидающий низший приоритет
+		for (int p = 0; p < LT_PRIO_LANES; p++) {
+			lite_msg_queue_t* q = lanes[p];
+			if (q == NULL || q->empty()) continue;
+			if (first < 0) {
+				first = p;
+			} else if (lane_skip[p].fetch_add(1, std::memory_order_relaxed) + 1 >= LT_PRIO_AGING && aged < 0) {
+				aged = p;
+			}
+		}
+		if (first < 0) return NULL;
+		int p = (aged >= 0 ? aged : first);
+		lane_skip[p].store(0, std::memory_order_relaxed);
+		lite_msg_t* msg = lanes[p].load()->pop(lock);
+		if (msg == NULL && p != first) msg = lanes[first].load()->pop(lock);
+		#ifdef LT_STAT
+		else if (p != first) lite_thread_stat_t::ti().stat_prio_aged++;
+		#endif
+		return msg;
+	}
 
-		msg_queue.push(msg);
+	#ifdef LT_STAT
+	// Группа гистограмм задержек: имя актора, для безымянных класс
+	int hist_key() {
+		int key = stat_key.load(std::memory_order_relaxed);
+		if (key == -2) {
+			key = lite_thread_stat_t::hist_key(name.empty() ? lite_type_name(typeid(*this)) : name);
+			stat_key.store(key, std::memory_order_relaxed);
+		}
+		return key;
+	}
+	#endif
 
-		if (msg == ti().msg_del) {
-			// Помеченное на удаление сообщение поместили в очередь другого актора. Снятие пометки
-			ti().msg_del = NULL;
+	// Передача обработанного сообщения номер seq в кольцо упорядочивания и отправка готовых по порядку.
+	// msg = NULL - сообщение исключено из порядка
+	void order_put(size_t seq, lite_msg_t* msg) noexcept {
+		lite_order_ring_t* o = order;
+		if (seq - o->head.load(std::memory_order_acquire) >= LT_ORDER_RING) {
+			// Ячейка занята: долго обрабатывается более раннее сообщение
+			#ifdef LT_STAT
+			lite_thread_stat_t::ti().stat_order_wait++;
+			#endif
+			while (seq - o->head.load(std::memory_order_acquire) >= LT_ORDER_RING) std::this_thread::yield();
 		}
+		#ifdef LT_STAT
+		if (seq != o->head.load(std::memory_order_relaxed)) lite_thread_stat_t::ti().stat_order_held++;
+		#endif
+		o->slot(seq).store(msg != NULL ? msg : lite_order_ring_t::skip());
+		// Отправку ведет один поток. Занявший ее поток после освобождения перепроверяет первую ячейку,
+		// т.к. пока он отправлял, другой поток мог положить сообщение и не получить отправку
+		while (!o->busy.exchange(true)) {
+			size_t h = o->head.load(std::memory_order_relaxed);
+			while (true) {
+				lite_msg_t* m = o->slot(h).load(std::memory_order_acquire);
+				if (m == NULL) break;
+				o->slot(h).store(NULL, std::memory_order_relaxed);
+				o->head.store(++h, std::memory_order_release);
+				if (m != lite_order_ring_t::skip()) o->next->run(m);
+			}
+			o->busy.store(false);
+			if (o->slot(h).load() == NULL) break;
+		}
+	}
+
+	// Проверка наличия работы
+	bool has_work() noexcept {
+		return !queue_empty() || timer_run;
+	}
+
+	// Постановка сообщения в очередь
+	void push(lite_msg_t* msg, int prio = LT_PRIO_NORMAL) noexcept {
+		#ifdef LT_STAT
+		msg->lite_msg_time = lite_time_ns();
+		#endif
+
+		(prio == LT_PRIO_NORMAL ? &msg_queue : lane_get(prio))->push(msg);
+
+		// Помеченное на удаление сообщение поместили в очередь другого актора. Снятие пометки
+		msg_unmark(msg);
 
 		cache_push(this);
 	}
 
-	// Запуск обработки всех сообщений очереди
-	void run_all() noexcept {
+	// Прямой вызов обработки в текущем потоке из обработчика другого актора. false - актор занят,
+	// сообщение нужно поставить в очередь
+	bool fuse_run(lite_msg_t* msg, int prio) noexcept {
+		thread_info_t& t = ti();
+		if (t.la_now_run == NULL || t.fuse_depth >= LT_FUSE_DEPTH || t.lr_now_used != resource || thread_max != 1 || order != NULL) return false;
+		int s = 0;
+		if (!sched.compare_exchange_strong(s, 1)) return false; // Уже в очереди готовых или выполняется
+		si().sched_count.fetch_add(1, std::memory_order_relaxed);
+		#ifdef LT_STAT
+		lite_thread_stat_t::ti().stat_fused++;
+		int64_t time_start = lite_time_ns();
+		#endif
+		msg_unmark(msg);
+		lite_msg_t* msg_del = t.msg_del; // Обрабатываемое отправителем сообщение
+		t.fuse_depth++;
+		if (batch_max == 1 && !timer_run && queue_empty()) {
+			// Очередь пуста, вызов обработчика напрямую
+			if (msg_capacity != 0) msg_count.fetch_sub(1, std::memory_order_relaxed);
+			actor_free--;
+			lite_actor_t* la_prev = t.la_now_run;
+			t.la_now_run = this;
+			t.msg_del = msg;
+			try {
+				recv(lite_msg_env_t::open(msg));
+			} catch(std::exception& e) {
+				exception(e);
+			}
+			if (msg == t.msg_del) delete msg;
+			t.la_now_run = la_prev;
+			actor_free++;
+			#ifdef LT_STAT
+			lite_thread_stat_t::ti().hist_add(hist_key(), 0, lite_time_ns() - time_start);
+			lite_thread_stat_t::ti().stat_msg_send++;
+			#endif
+			sched_release();
+		} else {
+			// Через очередь актора, чтобы сохранить порядок с ранее отправленными сообщениями
+			#ifdef LT_STAT
+			msg->lite_msg_time = time_start;
+			#endif
+			(prio == LT_PRIO_NORMAL ? &msg_queue : lane_get(prio))->push(msg);
+			run_ready(this);
+		}
+		t.fuse_depth--;
+		t.msg_del = msg_del;
+		return true;
+	}
+
+	// Постановка цепочки сообщений в очередь
+	void push_chain(lite_msg_t* first, lite_msg_t* last, size_t count, int prio = LT_PRIO_NORMAL) noexcept {
+
+		(prio == LT_PRIO_NORMAL ? &msg_queue : lane_get(prio))->push_chain(first, last, count);
+
+		thread_info_t& t = ti();
+		if (t.msg_del != NULL || t.msg_batch_size != 0) {
+			// Снятие пометки на удаление с отправленных сообщений
+			for (lite_msg_t* m = first; ; m = m->lite_msg_next) {
+				msg_unmark(m);
+				if (m == last) break;
+			}
+		}
+
+		// Многопоточный актор ставится в очередь по числу сообщений, но не более thread_max раз
+		size_t push_count = std::min(count, (size_t)thread_max);
+		for (size_t i = 0; i < push_count; i++) cache_push(this);
+	}
+
+	// Запуск обработки всех сообщений очереди. Возвращает false если ресурс занят
+	bool run_all() noexcept {
+		bool ret = true;
 		int free_now = --actor_free;
 		if (free_now < 0) {
 			// Уже выполняется разрешенное количество акторов
@@ -920,21 +2859,92 @@ protected:
 			#endif
 		} else if (resource_lock(resource)) { // Занимаем ресурс
 			thread_info_t& t = ti();
-			t.la_next_run = NULL;
+			lite_actor_t* la_prev = t.la_now_run;
 			t.la_now_run = this;
+			#ifdef LT_STAT
+			if (!has_work()) lite_thread_stat_t::ti().stat_cache_bad++;
+			int key = hist_key();
+			int64_t wait_ns[LT_BATCH_MAX]; // Время ожидания сообщений пачки в очереди
+			#endif
 			bool need_lock = (thread_max != 1); // Блокировка нужна только многопоточным акторам
+			while (batch_max > 1) {
+				// Извлечение пачки сообщений из очереди
+				lite_msg_t* batch[LT_BATCH_MAX];
+				size_t seq[LT_BATCH_MAX];
+				size_t n = 0;
+				while (n < (size_t)batch_max) {
+					lite_msg_t* msg = queue_pop(need_lock, order != NULL ? &seq[n] : NULL);
+					if (msg == NULL) break;
+					#ifdef LT_STAT
+					lite_thread_stat_t::ti().numa_count(lite_msg_pool_t::node_of(msg));
+					#endif
+					batch[n++] = msg;
+				}
+				if (n == 0) break;
+				#ifdef LT_STAT
+				int64_t time_pop = lite_time_ns();
+				for (size_t i = 0; i < n; i++) wait_ns[i] = time_pop - batch[i]->lite_msg_time;
+				#endif
+				// Пометка на удаление, копия т.к. обработчик может менять массив
+				lite_msg_t* batch_del[LT_BATCH_MAX];
+				memcpy(batch_del, batch, n * sizeof(lite_msg_t*));
+				for (size_t i = 0; i < n; i++) batch[i] = lite_msg_env_t::open(batch[i]);
+				lite_msg_t** batch_prev = t.msg_batch; // Пачка внешнего run_all() при вложенном вызове
+				size_t batch_prev_size = t.msg_batch_size;
+				t.msg_del = NULL;
+				t.msg_batch = batch_del;
+				t.msg_batch_size = n;
+				try {
+					recv_batch(batch, n); // Обработка
+				} catch(std::exception& e) {
+					exception(e);
+				}
+				#ifdef LT_STAT
+				int64_t work_ns = (lite_time_ns() - time_pop) / (int64_t)n;
+				for (size_t i = 0; i < n; i++) lite_thread_stat_t::ti().hist_add(key, wait_ns[i], work_ns);
+				#endif
+				t.msg_batch = batch_prev;
+				t.msg_batch_size = batch_prev_size;
+				if (order != NULL) {
+					// Отправленные обработчиком дальше исключаются из порядка
+					for (size_t i = 0; i < n; i++) order_put(seq[i], batch_del[i]);
+				} else {
+					for (size_t i = 0; i < n; i++) {
+						if (batch_del[i] != NULL) delete batch_del[i];
+					}
+				}
+				#ifdef LT_STAT
+				lite_thread_stat_t::ti().stat_msg_send += n;
+				#endif
+			}
 			while (true) {
 				// Извлечение сообщения из очереди
-				lite_msg_t* msg = msg_queue.pop(need_lock);
+				size_t seq = 0;
+				lite_msg_t* msg = queue_pop(need_lock, order != NULL ? &seq : NULL);
 				if (msg == NULL) break;
+				#ifdef LT_STAT
+				lite_thread_stat_t::ti().numa_count(lite_msg_pool_t::node_of(msg));
+				int64_t time_pop = lite_time_ns();
+				wait_ns[0] = time_pop - msg->lite_msg_time;
+				#endif
 				// Запуск функции
 				t.msg_del = msg; // Пометка на удаление
 				try {
-					recv(msg); // Обработка
+					recv(lite_msg_env_t::open(msg)); // Обработка
 				} catch(std::exception e) {
 					exception(e);
 				}
-				if (msg == t.msg_del) delete msg;
+				#ifdef LT_STAT
+				lite_thread_stat_t::ti().hist_add(key, wait_ns[0], lite_time_ns() - time_pop);
+				#endif
+				if (order != NULL) {
+					lite_msg_t* done = (msg == t.msg_del ? msg : NULL); // Отправленное обработчиком дальше исключается из порядка
+					t.msg_del = NULL;
+					order_put(seq, done);
+				} else if (msg == t.msg_del) {
+					t.msg_del = NULL; // Блок удаленного сообщения пул может сразу отдать новому, например из timer()
+					delete msg;
+				}
 				#ifdef LT_STAT
 				lite_thread_stat_t::ti().stat_msg_send++;
 				#endif
@@ -947,10 +2957,19 @@ protected:
 					exception(e);
 				}
 			}
-			in_cache = false;
+			t.la_now_run = la_prev;
+		} else {
+			ret = false;
 		}
 		actor_free++;
-		return;
+		return ret;
+	}
+
+	// Снятие постановки в очередь после выполнения. Если за время выполнения появилась работа - повторная постановка
+	void sched_release() noexcept {
+		sched--;
+		if (timer_run || !queue_empty_locked()) cache_push(this);
+		sched_done(1); // После повторной постановки, чтобы счетчик не обнулялся при наличии работы
 	}
 
 public:
@@ -982,6 +3001,13 @@ public:
 		}
 	}
 
+	// Установка размера пачки сообщений передаваемой в recv_batch()
+	void batch_set(int max) noexcept {
+		if (max <= 0) max = 1;
+		if (max > LT_BATCH_MAX) max = LT_BATCH_MAX;
+		batch_max = max;
+	}
+
 	// Установка глубины распараллеливания
 	void parallel_set(int count) noexcept {
 		if (count <= 0) count = 1;
@@ -990,18 +3016,25 @@ public:
 		actor_free += count - thread_max.exchange(count);
 	}
 
+	// Постановка в очередь готовых к выполнению потока n, чтобы разные акторы выполнялись в разных
+	// потоках. Другие потоки забирают актор при простое. n < 0 - в очередь потока-отправителя
+	void home_set(int n) noexcept {
+		home = (n < 0 ? -1 : n % LT_READY_QUEUES);
+	}
+
+	// Отправка обработанных сообщений актору next в порядке поступления при параллельной обработке.
+	// Вызывать до отправки сообщений
+	void order_set(lite_actor_t* next) noexcept {
+		assert(next != NULL && order == NULL);
+		order = new lite_order_ring_t(next);
+	}
+
 	// Проверка типа сообщения
 	bool check_type(lite_msg_t* msg) noexcept {
-		if (!type_list.empty()) {
+		if (!type_mask.empty()) {
 			// Проверка что тип сообщения в обрабатываемых
-			bool found = false;
-			for (auto& t : type_list) {
-				if (msg->lite_msg_type == t) {
-					found = true;
-					break;
-				}
-			}
-			if (!found) {
+			size_t t = msg->lite_msg_type;
+			if ((t >> 6) >= type_mask.size() || (type_mask[t >> 6] & ((uint64_t)1 << (t & 63))) == 0) {
 				lite_log(LITE_ERROR_MSG_TYPE, "'%s' recv '%s'", name_get().c_str(), msg->type_descr().c_str());
 				return false;
 			}
@@ -1009,27 +3042,107 @@ public:
 		return true;
 	}
 
-	// Помещение в очередь для последующего запуска
+	// Помещение в очередь для последующего запуска. prio < 0 - приоритет по типу сообщения
 	template <typename T>
-	void run(T* msg) noexcept {
-		lite_msg_t::type_set(msg);
+	void run(T* msg_, int prio = -1) noexcept {
+		lite_msg_t::type_set(msg_);
+		lite_msg_t* msg = (msg_->is_shared() ? lite_msg_env_t::wrap(msg_) : msg_);
 		if(check_type(msg)) {
-			push(msg);
-		} else if (msg != ti().msg_del) {
+			if (msg_capacity != 0) msg_count.fetch_add(1, std::memory_order_relaxed);
+			prio = prio_get(msg, prio);
+			if (!fuse || !fuse_run(msg, prio)) push(msg, prio);
+		} else if (!msg_is_marked(msg)) {
 			delete msg;
 		}
 	}
 
-	// Добавление обрабатываемого типа
-	void type_add(size_t type) noexcept {
-		bool found = false;
-		for (auto& t : type_list) {
-			if (type == t) {
-				found = true;
-				break;
+	// Помещение в очередь если она не заполнена. false - очередь заполнена, сообщение не принято и
+	// принадлежит отправителю
+	template <typename T>
+	bool try_run(T* msg_, int prio = -1) noexcept {
+		if (msg_capacity != 0 && msg_count.fetch_add(1, std::memory_order_relaxed) >= msg_capacity) {
+			msg_count.fetch_sub(1, std::memory_order_relaxed);
+			msg_unmark(msg_); // Обрабатываемое отправителем сообщение не удалять после recv()
+			#ifdef LT_STAT
+			lite_thread_stat_t::ti().stat_queue_full++;
+			#endif
+			return false;
+		}
+		lite_msg_t::type_set(msg_);
+		lite_msg_t* msg = (msg_->is_shared() ? lite_msg_env_t::wrap(msg_) : msg_);
+		if(check_type(msg)) {
+			prio = prio_get(msg, prio);
+			if (!fuse || !fuse_run(msg, prio)) push(msg, prio);
+		} else {
+			if (msg_capacity != 0) msg_count.fetch_sub(1, std::memory_order_relaxed);
+			if (!msg_is_marked(msg)) delete msg;
+		}
+		return true;
+	}
+
+	// Прямой вызов обработки из обработчика отправителя вместо постановки в очередь готовых
+	void fuse_set(bool on) noexcept {
+		fuse = on;
+	}
+
+	// Ограничение очереди max сообщениями для try_run(), 0 - без ограничения. Вызывать до отправки сообщений
+	void capacity_set(size_t max) noexcept {
+		msg_capacity = max;
+	}
+
+	// Количество сообщений в очереди, известно только при ограничении
+	size_t queue_size() const noexcept {
+		return msg_count.load(std::memory_order_relaxed);
+	}
+
+	// Помещение в очередь пачки сообщений одной блокировкой на каждую очередь приоритета
+	template <typename T>
+	void run_batch(T** msgs, size_t n, int prio = -1) noexcept {
+		lite_msg_t* first[LT_PRIO_LANES] = {0};
+		lite_msg_t* last[LT_PRIO_LANES] = {0};
+		size_t count[LT_PRIO_LANES] = {0};
+		#ifdef LT_STAT
+		int64_t now = lite_time_ns();
+		#endif
+		for (size_t i = 0; i < n; i++) {
+			lite_msg_t::type_set(msgs[i]);
+			lite_msg_t* msg = (msgs[i]->is_shared() ? lite_msg_env_t::wrap(msgs[i]) : msgs[i]);
+			if (!check_type(msg)) {
+				if (!msg_is_marked(msg)) delete msg;
+				continue;
+			}
+			#ifdef LT_STAT
+			msg->lite_msg_time = now;
+			#endif
+			int p = prio_get(msg, prio);
+			if (last[p] == NULL) {
+				first[p] = msg;
+			} else {
+				last[p]->lite_msg_next = msg;
 			}
+			last[p] = msg;
+			count[p]++;
 		}
-		if (!found) type_list.push_back(type);
+		for (int p = 0; p < LT_PRIO_LANES; p++) {
+			if (count[p] == 0) continue;
+			if (msg_capacity != 0) msg_count.fetch_add(count[p], std::memory_order_relaxed);
+			push_chain(first[p], last[p], count[p], p);
+		}
+	}
+
+	// Приоритет сообщений типа type (lite_msg_type<T>()) при отправке без явного приоритета. Вызывать до
+	// отправки сообщений: таблица читается отправителями без блокировки
+	void priority_set(size_t type, int prio) noexcept {
+		if (prio < 0) prio = LT_PRIO_NORMAL;
+		if (prio >= LT_PRIO_LANES) prio = LT_PRIO_LOW;
+		if (type >= type_prio.size()) type_prio.resize(type + 1, 0);
+		type_prio[type] = (uint8_t)(prio + 1);
+	}
+
+	// Добавление обрабатываемого типа
+	void type_add(size_t type) noexcept {
+		if ((type >> 6) >= type_mask.size()) type_mask.resize((type >> 6) + 1, 0);
+		type_mask[type >> 6] |= (uint64_t)1 << (type & 63);
 	}
 
 	// Установка периода вызова timer()
@@ -1037,30 +3150,53 @@ public:
 		lite_timer_run(this, time_ms);
 	}
 
+	// Установка периода вызова timer() в микросекундах
+	void timer_set_us(int64_t time_us) noexcept {
+		lite_timer_run_us(this, time_us);
+	}
+
 	// Вызов timer()
 	void timer_alert() noexcept {
-		if (!timer_run) {
-			timer_run = true;
+		if (!timer_run.exchange(true)) {
 			cache_push(this);
 		}
 	}
 
-	#ifdef LT_STAT
+	// Память под актор выделяется из пула потока на его узле NUMA
 	void *operator new(size_t size) {
+		#ifdef LT_STAT
 		lite_thread_stat_t::ti().stat_actor_create++;
-		return lite_align64_t::operator new(size);
+		#endif
+		void* p = lite_msg_pool_t::alloc(size);
+		if (p == NULL) {
+			assert(p != NULL);
+			throw std::bad_alloc();
+		}
+		return p;
 	}
 
 	void operator delete(void *p) {
+		#ifdef LT_STAT
 		lite_thread_stat_t::ti().stat_actor_erase++;
-		lite_align64_t::operator delete(p);
+		#endif
+		lite_msg_pool_t::free(p);
 	}
-	#endif
 
 	//-----------------------------------------------------------------------------------
 	// Обработчик сообщения, прописывать в дочернем классе
 	virtual void recv(lite_msg_t*) = 0;
 
+	// Обработчик пачки сообщений, вызывается при batch_set() > 1
+	virtual void recv_batch(lite_msg_t** msgs, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			try {
+				recv(msgs[i]);
+			} catch(std::exception& e) {
+				exception(e);
+			}
+		}
+	}
+
 	// Обработчик исключений
 	virtual void exception(std::exception& ex) {
 		lite_log(LITE_ERROR_EXCEPTION, "%s: exception %s", name_get().c_str(), ex.what());
@@ -1073,32 +3209,72 @@ public:
 		lite_log(LITE_ERROR_NOT_IMPLEMENTED, "%s method timer() is not implemented.", name_get().c_str());
 	}
 
-	virtual ~lite_actor_t() {}
+	virtual ~lite_actor_t() {
+		for (int i = 0; i < LT_PRIO_LANES; i++) {
+			if (i != LT_PRIO_NORMAL) delete lanes[i].load();
+		}
+		delete order;
+	}
 
 private:
 	// static переменные уровня потока -------------------------------------------------
 	struct thread_info_t : public lite_thread_info_t<thread_info_t> {
 		lite_msg_t* msg_del;		// Обрабатываемое сообщение, будет удалено после обработки
+		lite_msg_t** msg_batch;		// Обрабатываемая пачка сообщений, будут удалены после обработки
+		size_t msg_batch_size;
 		lite_actor_t* la_next_run;	// Следующий на выполнение актор
 		lite_actor_t* la_now_run;	// Текущий актор
 		lite_resource_t* lr_now_used;// Текущий захваченный ресурс
+		size_t fuse_depth;			// Глубина вложенных прямых вызовов
+		uint32_t rnd;				// Состояние генератора случайных чисел для выбора очереди
 	};
 
 	static thread_info_t& ti() noexcept {
 		return thread_info_t::tls_get();
 	}
 
+	// Сообщение помечено на удаление после обработки
+	static bool msg_is_marked(lite_msg_t* msg) noexcept {
+		thread_info_t& t = ti();
+		if (msg == t.msg_del) return true;
+		for (size_t i = 0; i < t.msg_batch_size; i++) {
+			if (t.msg_batch[i] == msg) return true;
+		}
+		return false;
+	}
+
+	// Снятие пометки на удаление. Возвращает true если пометка была
+	static bool msg_unmark(lite_msg_t* msg) noexcept {
+		thread_info_t& t = ti();
+		if (msg == t.msg_del) {
+			t.msg_del = NULL;
+			return true;
+		}
+		for (size_t i = 0; i < t.msg_batch_size; i++) {
+			if (t.msg_batch[i] == msg) {
+				t.msg_batch[i] = NULL;
+				return true;
+			}
+		}
+		return false;
+	}
+
 	// static переменные глобальные ----------------------------------------------------
-	typedef std::unordered_map<std::string, lite_actor_t*> lite_name_idx_t;
 	typedef std::vector<lite_actor_t*> lite_actor_list_t;
 
 	struct static_info_t : public lite_static_info_t<static_info_t> {
-		lite_name_idx_t la_name_idx;// Индекс для поиска lite_actor_t* по имени
-		lite_mutex_t mtx_idx;		// Блокировка для доступа к la_idx. В случае одновременной блокировки сначала mtx_idx затем mtx_list
+		lite_name_index_t la_name_idx;// Индекс для поиска lite_actor_t* по имени, чтение без блокировки
+		lite_mutex_t mtx_idx;		// Блокировка изменения la_name_idx. В случае одновременной блокировки сначала mtx_idx затем mtx_list
 		lite_actor_list_t la_list;	// Список акторов
 		lite_mutex_t mtx_list;		// Блокировка для доступа к la_list
 		lite_resource_t* res_default;// Ресурс по умолчанию
 		std::atomic<bool> is_destroy;// Идет удаление всех акторов
+		lite_ready_queue_t ready_queue[LT_READY_QUEUES + 1]; // Очереди готовых к выполнению по потокам + общая
+		std::atomic<size_t> ready_count = {0};	// Количество акторов в очередях готовых к выполнению
+		std::atomic<size_t> queue_used = {0};	// Количество используемых очередей потоков
+		std::atomic<size_t> sched_count = {0};	// Сумма sched всех акторов, 0 - нет работы
+		std::mutex mtx_idle;					// Для ожидания отсутствия работы
+		std::condition_variable cv_idle;		// Для ожидания отсутствия работы
 	};
 
 	static static_info_t& si() noexcept {
@@ -1106,100 +3282,156 @@ private:
 	}
 
 	// static методы глобальные ----------------------------------------------------
-	// Сохранение в кэш указателя на актор ожидающий исполнения
+	// Номер очереди готовых к выполнению текущего потока
+	static size_t queue_num() noexcept {
+		size_t n = lite_thread_num();
+		return n < LT_READY_QUEUES ? n : LT_READY_QUEUES; // Не рабочие потоки используют общую очередь
+	}
+
+	// Постановка в очередь готовых к выполнению: своего потока или потока home_set()
+	static void queue_push(lite_actor_t* la) noexcept {
+		size_t n = (la->home < 0 ? queue_num() : (size_t)la->home);
+		si().ready_queue[n].push(la);
+		si().ready_count++;
+		// Учет максимального номера используемой очереди, для ограничения перебора
+		size_t used = si().queue_used;
+		while (n < LT_READY_QUEUES && used <= n && !si().queue_used.compare_exchange_weak(used, n + 1));
+	}
+
+	// Постановка актора в очередь готовых к выполнению, если еще не поставлен
 	static void cache_push(lite_actor_t* la) noexcept {
 		assert(la != NULL);
-		if (!la->is_ready() || la->in_cache) return;
+		// Однопоточный актор ставится в очередь только один раз, многопоточный не более thread_max раз
+		int s = la->sched;
+		do {
+			if (s >= la->thread_max) return;
+		} while (!la->sched.compare_exchange_weak(s, s + 1));
+		si().sched_count.fetch_add(1, std::memory_order_relaxed);
 
 		thread_info_t& t = ti();
-		if (t.la_now_run != NULL && t.la_now_run->msg_queue.empty() && t.la_next_run == NULL && t.lr_now_used == la->resource) {
+		if (t.la_now_run != NULL && t.la_now_run->queue_empty() && t.la_next_run == NULL && t.lr_now_used == la->resource &&
+			(la->home < 0 || (size_t)la->home == queue_num())) {
 			// Выпоняется последнее задание текущего актора, запоминаем в локальный кэш потока для обработки его следующим
 			t.la_next_run = la;
 			return;
 		}
 
-		// Запись в кэш ресурса
-		la->resource->la_cache.push(la);
+		queue_push(la);
 
 		if(la->resource->is_free()) {
 			lite_thread_wake_up();
 		}
 	}
 
-	// Получение из кэша указателя на актор ожидающий исполнения
-	static lite_actor_t* cache_pop() noexcept {
+	// Перенос из локального кэша потока в очередь, если поток не будет искать следующий актор
+	static void next_run_flush() noexcept {
 		thread_info_t& t = ti();
-		// Проверка локального кэша
 		lite_actor_t* la = t.la_next_run;
 		if (la != NULL) {
 			t.la_next_run = NULL;
-			if (la->is_ready()) {
-				return la;
-			} else {
-				#ifdef LT_STAT
-				lite_thread_stat_t::ti().stat_cache_bad++;
-				#endif			
-				la = NULL;
-			}
+			queue_push(la);
+			lite_thread_wake_up();
 		}
-
-		if(t.lr_now_used != NULL) {
-			// Проверка кэша используемого ресурса
-			while ((la = t.lr_now_used->la_cache.pop()) != NULL) {
-				if (la->is_ready()) {
-					return la;
-				}
-			}
-		}
-
-		return NULL;
-	}
+	}
 
 	// Поиск ожидающего выполнение
 	static lite_actor_t* find_ready() noexcept {
-		// Извлечение из кэша
-		lite_actor_t* ret = cache_pop();
-		if (ret != NULL) {
+		thread_info_t& t = ti();
+		// Проверка локального кэша
+		lite_actor_t* la = t.la_next_run;
+		if (la != NULL) {
+			t.la_next_run = NULL;
 			#ifdef LT_STAT
 			lite_thread_stat_t::ti().stat_cache_found++;
 			#endif
-			return ret;
+			return la;
 		}
 
-		// Поиск перебором списка акторов
+		if (si().ready_count == 0) return NULL;
 		#ifdef LT_STAT
 		lite_thread_stat_t::ti().stat_actor_find++;
 		#endif
-
-		lite_lock_t lck(si().mtx_list); // Блокировка
-		lite_actor_list_t& la_list = si().la_list;
-		for (lite_actor_list_t::iterator it = la_list.begin(); it != la_list.end(); ++it) {
-			if ((*it)->is_ready()) {
-				ret = (*it);
-				ret->in_cache = true;
-				if(it != si().la_list.begin()) {
-					// Сдвиг активных ближе к началу
-					lite_actor_list_t::iterator it2 = it;
-					--it2;
-					(*it) = (*it2);
-					(*it2) = ret;
+		// Своя очередь
+		size_t own = queue_num();
+		la = si().ready_queue[own].pop();
+		if (la == NULL) {
+			// Очереди других потоков начиная со случайной
+			if (t.rnd == 0) t.rnd = (uint32_t)own * 2654435761U + 1;
+			size_t max = si().queue_used + 1;
+			if (max > LT_READY_QUEUES + 1) max = LT_READY_QUEUES + 1;
+			t.rnd ^= t.rnd << 13;
+			t.rnd ^= t.rnd >> 17;
+			t.rnd ^= t.rnd << 5;
+			size_t start = t.rnd % max;
+			// При привязке к процессорам сначала проверяются потоки с общим кэшем L3 и общая очередь,
+			// у которой нет своего процессора
+			for (int pass = (lite_topology_t::is_active() && own != LT_READY_QUEUES ? 0 : 1); pass < 2 && la == NULL; pass++) {
+				for (size_t i = 0; i < max && la == NULL; i++) {
+					size_t n = start + i;
+					if (n >= max) n -= max;
+					if (n + 1 == max) n = LT_READY_QUEUES; // Последней проверяется общая очередь
+					if (n == own || (pass == 0 && n != LT_READY_QUEUES && !lite_topology_t::is_near(own, n))) continue;
+					la = si().ready_queue[n].steal();
 				}
-				break;
-			} 
+			}
+			#ifdef LT_STAT
+			if (la != NULL) lite_thread_stat_t::ti().stat_actor_steal++;
+			#endif
+		}
+		if (la != NULL) si().ready_count--;
+		return la;
+	}
+
+	// Выполнение актора извлеченного из очереди готовых
+	static void run_ready(lite_actor_t* la) noexcept {
+		if (la->run_all()) {
+			la->sched_release();
+		} else {
+			// Ресурс занят, ожидание освобождения
+			lite_resource_t* res = la->resource;
+			res->la_cache.push(la);
+			std::atomic_thread_fence(std::memory_order_seq_cst); // Постановка в ожидание видна до проверки ресурса
+			if (res->is_free()) resource_wake(res); // Ресурс освободился до постановки в ожидание
+		}
+	}
+
+	// Постановка в очередь актора ожидающего освобождения ресурса
+	static void resource_wake(lite_resource_t* res) noexcept {
+		std::atomic_thread_fence(std::memory_order_seq_cst); // Освобождение ресурса видно до проверки ожидающих
+		lite_actor_t* la = res->la_cache.pop();
+		if (la != NULL) {
+			queue_push(la);
+			lite_thread_wake_up();
 		}
-		return ret;
 	}
 
 	// Количество готовых к выполнению
 	static size_t count_ready() noexcept {
-		lite_lock_t lck(si().mtx_list); // Блокировка
+		return si().ready_count;
+	}
+
+	// Удаление актора из всех очередей готовых к выполнению
+	static void queue_remove(lite_actor_t* la) noexcept {
 		size_t cnt = 0;
-		for (lite_actor_list_t::iterator it = si().la_list.begin(); it != si().la_list.end(); ++it) {
-			if ((*it)->is_ready()) {
-				cnt += (*it)->actor_free;
-			}
+		for (size_t i = 0; i <= LT_READY_QUEUES; i++) {
+			cnt += si().ready_queue[i].remove(la);
+		}
+		si().ready_count -= cnt;
+		cnt += la->resource->la_cache.remove(la);
+		if (ti().la_next_run == la) {
+			ti().la_next_run = NULL;
+			cnt++;
+		}
+		la->sched -= (int)cnt;
+		if (cnt != 0) sched_done(cnt);
+	}
+
+	// Снятие n постановок в очереди готовых. При обнулении пробуждение ожидающих отсутствия работы
+	static void sched_done(size_t n) noexcept {
+		if (si().sched_count.fetch_sub(n, std::memory_order_acq_rel) == n) {
+			{ std::lock_guard<std::mutex> lck(si().mtx_idle); } // Ожидающий проверил счетчик и ждет
+			si().cv_idle.notify_all();
 		}
-		return cnt;
 	}
 
 	// Захват и освобождение ресурса
@@ -1207,8 +3439,12 @@ private:
 		// Проверка что уже захвачен
 		if (res == ti().lr_now_used) return true;
 		// Освобождение ранее захваченного
-		if (ti().lr_now_used != NULL) ti().lr_now_used->unlock();
+		lite_resource_t* res_prev = ti().lr_now_used;
 		ti().lr_now_used = NULL;
+		if (res_prev != NULL) {
+			res_prev->unlock();
+			resource_wake(res_prev);
+		}
 		// Захват нового
 		if(res == NULL || res->lock()) {
 			ti().lr_now_used = res;
@@ -1227,20 +3463,27 @@ private:
 	// Установка имени актора
 	static void name_set(lite_actor_t* la, const std::string& name) {
 		lite_lock_t lck(si().mtx_idx); // Блокировка
-		lite_name_idx_t::iterator it = si().la_name_idx.find(name); // Поиск по индексу
-		if (it != si().la_name_idx.end()) {
-			if(it->second != la) lite_log(LITE_ERROR_ACTOR_DOUBLE, "Actor '%s' already exists", name.c_str());
+		lite_actor_t* la_prev = si().la_name_idx.find(name); // Поиск по индексу
+		if (la_prev != NULL) {
+			if(la_prev != la) lite_log(LITE_ERROR_ACTOR_DOUBLE, "Actor '%s' already exists", name.c_str());
 		} else if(!la->name.empty()) {
 			lite_log(LITE_ERROR_ACTOR_NAME, "Try set name '%s' to actor '%s'", name.c_str(), la->name.c_str());
 		} else {
-			si().la_name_idx[name] = la;
+			si().la_name_idx.insert(name, la);
 			la->name = name;
+			#ifdef LT_STAT
+			la->stat_key = -2; // Группа гистограмм по новому имени
+			#endif
 		}
 	}
 
 	// Очистка всего
 	static void clear() noexcept {
 		si().is_destroy = true;
+		for (size_t i = 0; i <= LT_READY_QUEUES; i++) si().ready_queue[i].clear();
+		si().ready_count = 0;
+		si().queue_used = 0;
+		ti().la_next_run = NULL;
 		while (!si().la_list.empty()) {
 			lite_actor_t* la_del = NULL;
 			{
@@ -1257,13 +3500,13 @@ private:
 			if (la_del->name == "log") {
 				la_del->run_all();
 				resource_lock(NULL);
+				ti().la_next_run = NULL;
 			} else {
 				la_del->before_destroy();
 			}
 			if (!la_del->name.empty()) { // Удаление из индекса
 				lite_lock_t lck(si().mtx_idx); // Блокировка
-				lite_name_idx_t::iterator it = si().la_name_idx.find(la_del->name);
-				if (it != si().la_name_idx.end()) si().la_name_idx.erase(it);
+				si().la_name_idx.erase(la_del->name);
 			}
 			delete la_del;
 		}
@@ -1271,6 +3514,7 @@ private:
 		assert(si().la_name_idx.empty());
 
 		si().res_default = NULL;
+		si().sched_count = 0; // Постановки удаленных без выполнения акторов
 		si().is_destroy = false;
 	}
 
@@ -1297,38 +3541,62 @@ public: //-------------------------------------------------------------
 		}
 		if (is_del && !la_del->name.empty()) { // Удаление из индекса
 			lite_lock_t lck(si().mtx_idx); // Блокировка
-			lite_name_idx_t::iterator it = si().la_name_idx.find(la_del->name);
-			if (it != si().la_name_idx.end()) si().la_name_idx.erase(it);
+			si().la_name_idx.erase(la_del->name);
 		}
 		// Дообработка оставщихся сообщений
 		if (is_del) {
 			la_del->timer_set(0);
 			la_del->before_destroy();
-			while (!la_del->msg_queue.empty()) {
+			while (true) {
+				queue_remove(la_del); // Удаление из очередей готовых к выполнению
 				la_del->run_all();
-				if (!la_del->msg_queue.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(20)); 
+				next_run_flush();
+				if (la_del->queue_empty() && la_del->sched == 0) break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Ожидание завершения в других потоках
 			}
-			assert(la_del->msg_queue.empty());
+			assert(la_del->queue_empty());
 			delete la_del;
 		}
 	}
 
+	// Рассылка сообщения n акторам списка без копирования. Сообщение становится общим
+	template <typename T>
+	static void msg_share(T* msg, lite_actor_t* const* list, size_t n) noexcept {
+		lite_msg_t::type_set(msg);
+		if (msg->is_shared()) { // Уже общее, по конверту на каждого
+			for (size_t i = 0; i < n; i++) list[i]->run(msg);
+			return;
+		}
+		msg_unmark(msg); // Полученное извне снимается с автоудаления
+		if (n == 0) {
+			delete msg;
+			return;
+		}
+		msg->lite_msg_refs.store((uint32_t)n, std::memory_order_relaxed); // До отправки, т.к. первый получатель может уже освободить
+		for (size_t i = 0; i < n; i++) list[i]->run(new lite_msg_env_t(msg));
+	}
+
 	// Получание актора по имени
 	static lite_actor_t* name_find(const std::string& name) {
-		lite_lock_t lck(si().mtx_idx); // Блокировка
-		lite_name_idx_t::iterator it = si().la_name_idx.find(name); // Поиск по индексу
-		lite_actor_t* la = NULL;
-		if (it != si().la_name_idx.end()) {
-			la = it->second;
-		}
-		return la;
+		return si().la_name_idx.find(name); // Поиск по индексу без блокировки
+	}
+
+	// Номер изменения индекса имен
+	static size_t name_gen() noexcept {
+		return si().la_name_idx.generation();
+	}
+
+	// Ожидание отсутствия ожидающих и выполняющихся акторов. Не вызывать из актора
+	static void wait_idle() noexcept {
+		assert(ti().la_now_run == NULL);
+		std::unique_lock<std::mutex> lck(si().mtx_idle);
+		si().cv_idle.wait(lck, [] { return si().sched_count.load(std::memory_order_acquire) == 0; });
 	}
 
 	// Копирование сообщения
 	template <typename T>
 	static T* msg_copy(T* msg) noexcept {
-		if (ti().msg_del == msg) {
-			ti().msg_del = NULL; // Снятие пометки на удаление
+		if (msg_unmark(msg)) { // Снятие пометки на удаление
 			return msg;
 		} else {
 			T* msg2 = new T(*msg);
@@ -1347,26 +3615,265 @@ public: //-------------------------------------------------------------
 	}
 };
 
+// Ссылка на актор по имени. Поиск повторяется только после изменения индекса имен, иначе
+// возвращается закэшированный указатель. Объект ссылки не потокобезопасен, у каждого потока свой
+class lite_actor_ref_t {
+	std::string name;
+	lite_actor_t* la;
+	size_t gen;			// Номер изменения индекса при поиске
+
+public:
+	lite_actor_ref_t(const std::string& name) : name(name), la(NULL), gen(SIZE_MAX) {}
+
+	lite_actor_t* get() {
+		size_t g = lite_actor_t::name_gen();
+		if (g != gen) {
+			la = lite_actor_t::name_find(name);
+			gen = g;
+		}
+		return la;
+	}
+};
+
+// Кредиты потока сообщений от одного отправителя. Отправитель берет кредит на сообщение, получатель
+// возвращает после обработки. Без кредитов отправитель ждет вызова timer() при их возврате
+class lite_credit_t {
+	std::atomic<int64_t> credit;		// Доступно кредитов
+	std::atomic<lite_actor_t*> waiter;	// Ожидающий кредитов отправитель
+	int64_t wake_level;					// Сколько кредитов должно вернуться для пробуждения отправителя
+
+	// Пробуждение отправителя если вернулось достаточно кредитов
+	void wake(int64_t n) noexcept {
+		if (credit.load(std::memory_order_seq_cst) < std::max(n, wake_level)) return;
+		lite_actor_t* w = waiter.exchange(NULL);
+		if (w != NULL) w->timer_alert();
+	}
+
+public:
+	// Отправитель будится когда вернется половина кредитов, чтобы не пробуждать его на каждый
+	lite_credit_t(int64_t count) : credit(count), waiter(NULL), wake_level(count > 1 ? count / 2 : 1) {}
+
+	// Взять n кредитов. false - кредитов недостаточно, у la будет вызван timer() при их возврате
+	bool take(lite_actor_t* la, int64_t n = 1) noexcept {
+		if (credit.fetch_sub(n, std::memory_order_acquire) >= n) return true;
+		credit.fetch_add(n, std::memory_order_relaxed);
+		waiter.store(la, std::memory_order_seq_cst);
+		wake(n); // Кредиты могли вернуть до установки waiter
+		#ifdef LT_STAT
+		lite_thread_stat_t::ti().stat_credit_wait++;
+		#endif
+		return false;
+	}
+
+	// Вернуть n кредитов
+	void give(int64_t n = 1) noexcept {
+		credit.fetch_add(n, std::memory_order_seq_cst);
+		if (waiter.load(std::memory_order_seq_cst) != NULL) wake(1);
+	}
+
+	// Доступно кредитов
+	int64_t available() const noexcept {
+		return credit.load(std::memory_order_relaxed);
+	}
+};
+
+// Перемешивание ключа для равномерного распределения последовательных ключей (финализатор MurmurHash3)
+static inline uint64_t lite_key_hash(uint64_t key) noexcept {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+// Актор, разделенный по ключу (например номеру потока данных) на части. Каждая часть - отдельный
+// однопоточный актор A со своими данными, сообщения одного ключа обрабатываются по порядку, разных
+// частей - параллельно. Выбор части выполняется в потоке отправителя, без общей очереди.
+// Части удаляются в lite_thread_end() как остальные акторы, объект раздела после этого не использовать
+template <typename A>
+class lite_shard_t {
+	std::vector<A*> shards;
+
+public:
+	// Создание count частей, args передаются конструктору каждой. Части распределяются по очередям
+	// готовых к выполнению рабочих потоков, пул задается до создания раздела
+	template <typename... Args>
+	lite_shard_t(size_t count, Args&&... args) {
+		if (count == 0) count = 1;
+		size_t threads = lite_thread_workers();
+		shards.reserve(count);
+		for (size_t i = 0; i < count; i++) {
+			A* a = new A(args...);
+			a->home_set((int)(i % threads));
+			shards.push_back(a);
+		}
+	}
+
+	// Часть, обрабатывающая ключ
+	A* get(uint64_t key) const noexcept {
+		return shards[lite_key_hash(key) % shards.size()];
+	}
+
+	// Отправка сообщения в часть ключа
+	template <typename T>
+	void run(T* msg, uint64_t key, int prio = -1) noexcept {
+		get(key)->run(msg, prio);
+	}
+
+	// Часть по номеру
+	A* shard(size_t i) const noexcept {
+		return shards[i];
+	}
+
+	size_t size() const noexcept {
+		return shards.size();
+	}
+};
+
 //-------------------------------------------------------------------------
 //---------------------- ТАЙМЕР -------------------------------------------
 //-------------------------------------------------------------------------
 // Вызов акторов по таймеру.
 
+#ifndef LT_TIMER_TICK_US
+#define LT_TIMER_TICK_US 10 // Шаг колеса таймеров, мкс
+#endif
+#define LT_TIMER_LEVELS 5	// Уровней колеса, по 64 ячейки. Диапазон 64^5 шагов, дальше откладывается в последний уровень
+#define LT_TIMER_THREAD 0	// Таймеры обрабатываются отдельным потоком
+#define LT_TIMER_WORKER 1	// Таймеры обрабатываются рабочими потоками между акторами
+
+// Иерархическое колесо таймеров. Добавление и удаление O(1), время в нс от lite_time_ns()
 class lite_timer_t {
 
 	struct task_t { // Задание
+		task_t* prev;		// Соседи в ячейке колеса
+		task_t* next;
 		lite_actor_t* la;	// Актор
-		int step;			// Периодичность оповещения, мс
+		int64_t step;		// Периодичность оповещения, нс
+		int64_t time;		// Время срабатывания, нс
+		int64_t tick;		// Шаг срабатывания
 	};
-	typedef std::multimap<int64_t, task_t> task_list_t; // Список заданий с сортировкой по времени срабатывания
 
-	task_list_t task_list;
+	task_t slot[LT_TIMER_LEVELS][64];		// Ячейки колеса, заголовки кольцевых списков
+	uint64_t used[LT_TIMER_LEVELS];			// Битовая маска непустых ячеек
+	std::unordered_map<lite_actor_t*, task_t*> task_idx; // Задания по актору
+	int64_t tick_ns;						// Шаг колеса, нс
+	int64_t time_start;						// Время шага 0, нс
+	int64_t tick_now;						// Последний обработанный шаг
+	int mode;								// LT_TIMER_THREAD или LT_TIMER_WORKER
 
+public:
+	std::atomic<int64_t> time_next;			// Время следующей проверки, нс. 0 если заданий нет
 
-	std::thread thread;			// Поток ожидания
+private:
 
+	std::thread thread;			// Поток ожидания
 	std::mutex mtx;				// Для засыпания
 	std::condition_variable cv;	// Для засыпания
+	bool is_stop;				// Остановка потока
+
+	// Добавление в ячейку по времени срабатывания
+	void insert(task_t* t) noexcept {
+		int64_t delta = t->tick - tick_now;
+		if (delta <= 0) { // Время прошло, срабатывание на следующем шаге
+			t->tick = tick_now + 1;
+			delta = 1;
+		}
+		int level = 0;
+		while (level < LT_TIMER_LEVELS - 1 && delta >= ((int64_t)1 << (6 * (level + 1)))) level++;
+		int64_t pos = t->tick;
+		if (delta >= ((int64_t)1 << (6 * LT_TIMER_LEVELS))) pos = tick_now + ((int64_t)63 << (6 * level)); // За пределами колеса
+		size_t idx = (size_t)(pos >> (6 * level)) & 63;
+		task_t* head = &slot[level][idx];
+		t->prev = head->prev;
+		t->next = head;
+		head->prev->next = t;
+		head->prev = t;
+		used[level] |= (uint64_t)1 << idx;
+	}
+
+	// Удаление из ячейки
+	void unlink(task_t* t) noexcept {
+		t->prev->next = t->next;
+		t->next->prev = t->prev;
+		t->prev = t->next = t;
+	}
+
+	// Отсоединение всех заданий ячейки, возвращает первое (список по next до NULL)
+	task_t* slot_take(int level, size_t idx) noexcept {
+		task_t* head = &slot[level][idx];
+		task_t* first = NULL;
+		if (head->next != head) {
+			first = head->next;
+			head->prev->next = NULL;
+			head->next = head->prev = head;
+		}
+		used[level] &= ~((uint64_t)1 << idx);
+		return first;
+	}
+
+	// Перенос заданий ячейки уровня level, в которую перешло время, на нижние уровни
+	void cascade(int level) noexcept {
+		size_t idx = (size_t)(tick_now >> (6 * level)) & 63;
+		if (idx == 0 && level + 1 < LT_TIMER_LEVELS) cascade(level + 1);
+		task_t* t = slot_take(level, idx);
+		while (t != NULL) {
+			task_t* next = t->next;
+			insert(t);
+			t = next;
+		}
+	}
+
+	// Обработка шагов до текущего времени. Вызывается под блокировкой
+	void advance(int64_t now) noexcept {
+		int64_t tick_end = (now - time_start) / tick_ns;
+		while (tick_now < tick_end) {
+			if (used[0] == 0) { // Нижний уровень пуст, переход сразу к следующему переносу
+				int64_t last = tick_now | 63;
+				if (last >= tick_end) {
+					tick_now = tick_end;
+					break;
+				}
+				tick_now = last;
+			}
+			tick_now++;
+			if ((tick_now & 63) == 0) cascade(1);
+			task_t* t = slot_take(0, (size_t)tick_now & 63);
+			while (t != NULL) {
+				task_t* next = t->next;
+				t->prev = t->next = t;
+				t->la->timer_alert();
+				// Следующее срабатывание, пропущенные моменты не повторяются
+				t->time += t->step;
+				if (t->time <= now) t->time += ((now - t->time) / t->step + 1) * t->step;
+				t->tick = (t->time - time_start + tick_ns - 1) / tick_ns;
+				insert(t);
+				t = next;
+			}
+		}
+	}
+
+	// Время следующей проверки, нс. 0 если заданий нет
+	int64_t next_time() noexcept {
+		if (task_idx.empty()) return 0;
+		int64_t tick = INT64_MAX;
+		for (int level = 0; level < LT_TIMER_LEVELS; level++) {
+			if (used[level] == 0) continue;
+			// Ближайшая непустая ячейка уровня после текущей
+			int64_t base = (tick_now >> (6 * level)) + 1;
+			size_t pos = (size_t)base & 63;
+			uint64_t mask = (used[level] >> pos) | (pos != 0 ? used[level] << (64 - pos) : 0);
+			int64_t dist = 0;
+			while ((mask & 1) == 0) {
+				mask >>= 1;
+				dist++;
+			}
+			int64_t t = (base + dist) << (6 * level); // Срабатывание или перенос на нижний уровень
+			if (t < tick) tick = t;
+		}
+		return time_start + tick * tick_ns;
+	}
 
 	// Функция потока
 	static void thread_func(lite_timer_t* const tmr) noexcept {
@@ -1374,87 +3881,94 @@ class lite_timer_t {
 		lite_log(0, "timer thread start");
 		#endif
 		std::unique_lock<std::mutex> lck(tmr->mtx);
-		while(!tmr->task_list.empty()) {
-			int64_t now = lite_time_now(), sleep_ms = 0;
-
-			while(true) { // Запуск тех, у кого время наступило
-				task_list_t::iterator it = tmr->task_list.begin();
-				if (it->first > now) {
-					now = lite_time_now();
-					if(it->first > now) {
-						sleep_ms = it->first - now + 1;
-						break;
-					}
-				}
-				it->second.la->timer_alert();
-				int64_t next = it->first + it->second.step;
-				while(next <= now) next += it->second.step;
-				tmr->task_list.insert(std::pair<int64_t, task_t>(next, it->second));
-				tmr->task_list.erase(it);
+		while (!tmr->is_stop) {
+			tmr->advance(lite_time_ns());
+			int64_t next = tmr->time_next = tmr->next_time();
+			if (next == 0) {
+				tmr->cv.wait(lck);
+			} else {
+				int64_t sleep_ns = next - lite_time_ns();
+				if (sleep_ns > 0) tmr->cv.wait_for(lck, std::chrono::nanoseconds(sleep_ns)); // Ожидание времени следущей сработки
 			}
-
-			assert(sleep_ms > 0);
-			tmr->cv.wait_for(lck, std::chrono::milliseconds(sleep_ms)); // Ожидание времени следущей сработки
 		}
 		#ifdef LT_DEBUG
 		lite_log(0, "timer thread stop");
 		#endif	
 	}
 
-	// Поиск настроек актора
-	task_list_t::iterator find(lite_actor_t* la) noexcept {
-		task_list_t::iterator it = task_list.begin();
-		for(; it != task_list.end(); it++) {
-			if (it->second.la == la) break;
+public:
+	lite_timer_t(int mode = LT_TIMER_THREAD) : tick_ns(LT_TIMER_TICK_US * 1000), time_start(lite_time_ns()), tick_now(0), mode(mode), time_next(0), is_stop(false) {
+		for (int l = 0; l < LT_TIMER_LEVELS; l++) {
+			used[l] = 0;
+			for (int i = 0; i < 64; i++) slot[l][i].prev = slot[l][i].next = &slot[l][i];
 		}
-		return it;
+		if (mode == LT_TIMER_THREAD) thread = std::thread(thread_func, this);
 	}
 
-public:
-	// Добавление таймера 
-	void set(lite_actor_t* la, int time_ms) noexcept {
+	// Добавление таймера с периодом time_ns, при time_ns <= 0 удаление
+	void set(lite_actor_t* la, int64_t time_ns) noexcept {
 		std::unique_lock<std::mutex> lck(mtx); // Блокировка
-		bool start_thread = task_list.empty();
 		#ifdef LT_DEBUG
-		lite_log(0, "timer %d ms for %s start_thread = %d", time_ms, la->name_get().c_str(), start_thread);
+		lite_log(0, "timer %lld us for %s", (long long)(time_ns / 1000), la->name_get().c_str());
 		#endif
+		advance(lite_time_ns());
 		// Удаление предыдущих настроек для la
-		task_list_t::iterator it = find(la);
-		if (it != task_list.end()) task_list.erase(it);
-
-		if (time_ms <= 0) {
-			cv.notify_all();
-			return; // Остановка таймера
+		auto it = task_idx.find(la);
+		if (it != task_idx.end()) {
+			unlink(it->second);
+			delete it->second;
+			task_idx.erase(it);
+		}
+		if (time_ns <= 0) { // Остановка таймера
+			time_next = next_time();
+			return;
 		}
 
+		task_t* t = new task_t;
+		t->la = la;
+		t->step = time_ns;
+		t->time = lite_time_ns() + time_ns;
+		t->tick = (t->time - time_start + tick_ns - 1) / tick_ns;
+		insert(t);
+		task_idx[la] = t;
+		time_next = next_time();
+		lck.unlock();
+		cv.notify_all();
+	}
 
-		task_t t;
-		t.la = la;
-		t.step = time_ms;
-		task_list.insert(std::pair<int64_t, task_t>(lite_time_now() + time_ms, t));
+	// Обработка наступивших срабатываний рабочим потоком. Возвращает время следующей проверки, 0 если заданий нет
+	int64_t poll() noexcept {
+		std::unique_lock<std::mutex> lck(mtx, std::try_to_lock);
+		if (!lck.owns_lock()) return time_next; // Обрабатывает другой поток
+		advance(lite_time_ns());
+		return time_next = next_time();
+	}
 
-		lck.unlock();
-		if(start_thread) { // Первое задание. Запуск потока.
-			if(thread.joinable()) {
-				cv.notify_all();
-				thread.join();
-			}
-			thread = std::thread(thread_func, this);
-		} else {
-			cv.notify_all();
-		}
+	// Таймеры обрабатываются рабочими потоками
+	bool is_worker() noexcept {
+		return mode == LT_TIMER_WORKER;
 	}
 
 	// Остановка всех таймеров
 	void stop_all() {
 		std::unique_lock<std::mutex> lck(mtx); // Блокировка
-		task_list.clear();
+		for (auto& it : task_idx) {
+			unlink(it.second);
+			delete it.second;
+		}
+		task_idx.clear();
+		for (int l = 0; l < LT_TIMER_LEVELS; l++) used[l] = 0;
+		time_next = 0;
 	}
 
 	// Завершение работы
 	~lite_timer_t() {
 		stop_all();
 		if (thread.joinable()) {
+			{
+				std::unique_lock<std::mutex> lck(mtx);
+				is_stop = true;
+			}
 			cv.notify_all();
 			thread.join();
 		}
@@ -1471,9 +3985,22 @@ class lite_thread_t : lite_align64_t {
 	std::condition_variable cv;	// Для засыпания
 	bool is_free;				// Поток свободен
 	bool is_end;				// Поток завершен
+	std::thread th;				// Поток. Деструкторы thread_local выполняются после выхода из thread_func(),
+								// поэтому перед удалением описателя поток дожидается
+	#ifdef LT_STAT
+	std::atomic<int64_t> wake_time;	// Время запроса пробуждения, нс
+	#endif
 
 	// Конструктор
-	lite_thread_t(size_t num) : num(num), is_free(true), is_end(false) { }
+	lite_thread_t(size_t num) : num(num), is_free(true), is_end(false) {
+		#ifdef LT_STAT
+		wake_time = 0;
+		#endif
+	}
+
+	~lite_thread_t() {
+		if (th.joinable()) th.join();
+	}
 
 	// Общие данные всех потоков
 	struct static_info_t : public lite_static_info_t<static_info_t> {
@@ -1485,19 +4012,24 @@ class lite_thread_t : lite_align64_t {
 		std::mutex mtx_end;							// Для ожидания завершения потоков
 		std::condition_variable cv_end;				// Для ожидания завершения потоков
 		lite_timer_t* timer = { 0 };				// Таймер вызова акторов по времени
+		std::atomic<size_t> pool_min = {0};			// Минимальное количество потоков
+		std::atomic<int> spin_us = {0};				// Время опроса очередей перед засыпанием, мкс
+		int timer_mode = {LT_TIMER_THREAD};			// Обработка таймеров отдельным потоком или рабочими
 	};
 
 	static static_info_t& si() {
 		return static_info_t::si();
 	}
 
-	// Создание потока
-	static void create_thread() noexcept {
-		if (si().stop) return;
+	// Создание потока, если запущено меньше max. Возвращает false, если поток не создан
+	static bool create_thread(size_t max = SIZE_MAX) noexcept {
+		if (si().stop) return false;
+		lite_clock_t::init(); // До запуска рабочих потоков
 		lite_thread_t* lt;
 		{
 			lite_lock_t lck(si().mtx); // Блокировка
 			size_t num = si().thread_count;
+			if (num >= max) return false; // Проверка под блокировкой: пул могут запускать несколько потоков
 			if (si().worker_list.size() == num) {
 				si().worker_list.push_back(NULL);
 			} else {
@@ -1509,21 +4041,23 @@ class lite_thread_t : lite_align64_t {
 			lt = new lite_thread_t(num);
 			si().worker_list[num] = lt;
 			si().thread_count++;
+			lt->th = std::thread(thread_func, lt); // Под блокировкой: end() не удалит описатель до записи th
 		}
-		std::thread th(thread_func, lt);
-		th.detach();
 
 		#ifdef LT_STAT
 		lite_thread_stat_t::ti().stat_thread_create++;
 		size_t cnt = si().thread_count;
 		if (lite_thread_stat_t::ti().stat_thread_max < cnt) lite_thread_stat_t::ti().stat_thread_max = cnt;
 		#endif
+		return true;
 	}
 
 	// Поиск свободного потока
 	static lite_thread_t* find_free() noexcept {
+		size_t num = this_num();
+		bool near = lite_topology_t::is_active() && num != 999; // Предпочтение потокам с общим кэшем
 		lite_thread_t* wf = si().worker_free;
-		if(wf != NULL && wf->is_free) return wf;
+		if(wf != NULL && wf->is_free && (!near || lite_topology_t::is_near(num, wf->num))) return wf;
 
 		if (si().thread_count == 0) return NULL;
 		wf = NULL;
@@ -1531,16 +4065,25 @@ class lite_thread_t : lite_align64_t {
 		size_t max = si().thread_count;
 		assert(max <= si().worker_list.size());
 
+		int wf_level = 0; // 2 - общий L2, 1 - общий L3
 		for (size_t i = 0; i < max; i++) {
 			lite_thread_t* w = si().worker_list[i];
 			assert(w != NULL);
 			if (w->is_free) {
-				wf = w;
-				break;
+				if (!near) {
+					wf = w;
+					break;
+				}
+				int level = lite_topology_t::is_near(num, w->num, 2) ? 2 : (lite_topology_t::is_near(num, w->num, 3) ? 1 : 0);
+				if (wf == NULL || level > wf_level) {
+					wf = w;
+					wf_level = level;
+					if (level == 2) break;
+				}
 			}
 		}
 
-		si().worker_free = wf;
+		if (!near) si().worker_free = wf;
 		return wf;
 	}
 
@@ -1560,22 +4103,54 @@ class lite_thread_t : lite_align64_t {
 		return ret;
 	}
 
+	// Обработка наступивших таймеров рабочим потоком. Возвращает время следующей проверки, 0 если нет таймеров
+	static int64_t timer_poll() noexcept {
+		lite_timer_t* tmr = si().timer;
+		if (tmr == NULL || !tmr->is_worker()) return 0;
+		int64_t next = tmr->time_next;
+		if (next == 0 || lite_time_ns() < next) return next;
+		return tmr->poll();
+	}
+
 	// Обработка сообщений
 	static void work_msg(lite_actor_t* la = NULL) noexcept {
 		if (la == NULL) la = lite_actor_t::find_ready();
 		while (la != NULL) {
-			la->run_all();
+			lite_actor_t::run_ready(la);
+			timer_poll();
 			la = lite_actor_t::find_ready();
 		}
 		lite_actor_t::resource_lock(NULL);
 	}
 
+	// Опрос очередей готовых к выполнению в течение spin_us перед засыпанием
+	static lite_actor_t* spin_ready() noexcept {
+		int64_t end = lite_time_ns() + (int64_t)si().spin_us * 1000;
+		do {
+			for (int i = 0; i < 64; i++) lite_cpu_relax();
+			lite_actor_t* la = lite_actor_t::find_ready();
+			if (la != NULL) {
+				#ifdef LT_STAT
+				lite_thread_stat_t::ti().stat_spin_found++;
+				#endif
+				return la;
+			}
+		} while (!si().stop && lite_time_ns() < end);
+		return NULL;
+	}
+
+	// Запуск потоков до минимального количества пула
+	static void pool_start() noexcept {
+		while (create_thread(si().pool_min));
+	}
+
 	// Функция потока
 	static void thread_func(lite_thread_t* const lt) noexcept {
 		#ifdef LT_DEBUG
 		lite_log(0, "thread#%d start", (int)lt->num);
 		#endif
 		this_num(lt->num);
+		lite_topology_t::pin(lt->num);
 		// Пробуждение другого потока если ожидающих акторов больше одного
 		if(lite_actor_t::count_ready() > 1) {
 			lt->is_free = false;
@@ -1584,7 +4159,9 @@ class lite_thread_t : lite_align64_t {
 		// Цикл обработки сообщений
 		while(true) {
 			// Проверка необходимости и создание новых потоков
+			int64_t timer_next = timer_poll();
 			lite_actor_t* la = lite_actor_t::find_ready();
+			if (la == NULL && si().spin_us > 0 && !si().stop) la = spin_ready();
 			if(la != NULL) { // Есть что обрабатывать
 				lt->is_free = false;
 				// Обработка сообщений
@@ -1598,15 +4175,26 @@ class lite_thread_t : lite_align64_t {
 				#ifdef LT_DEBUG
 				lite_log(0, "thread#%d sleep at %lld ms", (int)lt->num, lite_time_now());
 				#endif
-				if(thread_work() == 0) si().cv_end.notify_one(); // Если никто не работает, то разбудить ожидание завершения
+				#ifdef LT_STAT
+				thread_work(); // Учет максимума одновременно работающих потоков
+				#endif
 				lite_thread_t* wf = si().worker_free;
 				while(wf == NULL || wf->num > lt->num) { // Следующим будить поток с меньшим номером
 					si().worker_free.compare_exchange_weak(wf, lt);
 				}
 				std::unique_lock<std::mutex> lck(lt->mtx_sleep);
 				lt->is_free = true;
-				if(lt->cv.wait_for(lck, std::chrono::seconds(1)) == std::cv_status::timeout) {	// Проснулся по таймауту
-					stop = (lt->num == si().thread_count - 1);	// Остановка потока с наибольшим номером
+				#ifdef LT_STAT
+				lt->wake_time = 0; // Запрос пробуждения до засыпания не учитывается
+				#endif
+				int64_t sleep_ns = 1000000000;
+				if (timer_next != 0 && lt->num == 0) { // Пробуждение первого потока к срабатыванию таймера
+					int64_t ns = timer_next - lite_time_ns();
+					if (ns < sleep_ns) sleep_ns = (ns > 0 ? ns : 0);
+				}
+				if(lt->cv.wait_for(lck, std::chrono::nanoseconds(sleep_ns)) == std::cv_status::timeout) {	// Проснулся по таймауту
+					stop = (lt->num == si().thread_count - 1 && lt->num >= si().pool_min);	// Остановка потока с наибольшим номером сверх пула
+					if (timer_next != 0 && lt->num == 0) stop = false; // Первый поток обрабатывает таймеры
 					#ifdef LT_DEBUG
 					lite_log(0, "thread#%d wake up (total: %d, work: %d)", (int)lt->num, (int)si().thread_count, (int)thread_work());
 					#endif
@@ -1616,6 +4204,12 @@ class lite_thread_t : lite_align64_t {
 					#endif
 					#ifdef LT_STAT
 					lite_thread_stat_t::ti().stat_thread_wake_up++;
+					int64_t wt = lt->wake_time.exchange(0);
+					if (wt != 0) { // Задержка пробуждения
+						size_t delay = (size_t)(lite_time_ns() - wt);
+						lite_thread_stat_t::ti().stat_wake_up_time += delay;
+						if (lite_thread_stat_t::ti().stat_wake_up_max < delay) lite_thread_stat_t::ti().stat_wake_up_max = delay;
+					}
 					#endif
 				}
 				if (si().worker_free == lt) {
@@ -1640,59 +4234,88 @@ class lite_thread_t : lite_align64_t {
 		lite_log(0, "thread#%d stop", (int)lt->num);
 		#endif
 		lite_actor_t::thread_end();
+		lite_msg_pool_t::thread_end();
 		#ifdef LT_STAT
 		lite_thread_stat_t::thread_end();
 		#endif
+		lite_log_thread_end();
 	}
 
 public: //-------------------------------------
 	// Пробуждение свободного потока
 	static void wake_up() noexcept {
+		if (si().thread_count < si().pool_min) pool_start(); // Пул еще не запущен
 		lite_thread_t* wf = find_free();
 		if (wf != NULL) {
-			wf->cv.notify_one();
 			#ifdef LT_STAT
+			int64_t wt = 0;
+			wf->wake_time.compare_exchange_strong(wt, lite_time_ns());
 			lite_thread_stat_t::ti().stat_try_wake_up++;
 			#endif
+			wf->cv.notify_one();
 		} else {
 			create_thread();
 		}
 	}
 
+	// Количество потоков пула
+	static size_t pool_get() noexcept {
+		return si().pool_min;
+	}
+
+	// Количество рабочих потоков для распределения работы: размер пула, без пула - количество ядер
+	static size_t worker_count() noexcept {
+		size_t n = si().pool_min;
+		if (n == 0) n = std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+	}
+
+	// Пул заранее запущенных потоков
+	static void pool_set(size_t count, int spin_us) noexcept {
+		lite_clock_t::init();
+		si().pool_min = count;
+		si().spin_us = (spin_us > 0 ? spin_us : 0);
+		pool_start();
+	}
+
 	// Установка таймера для la
-	static void timer_set(lite_actor_t* la, int time_ms) noexcept {
+	static void timer_set(lite_actor_t* la, int64_t time_ns) noexcept {
 		if(si().timer == NULL) {
-			if (time_ms <= 0) return;
-			si().timer = new lite_timer_t;
+			if (time_ns <= 0) return;
+			si().timer = new lite_timer_t(si().timer_mode);
 		}
-		si().timer->set(la, time_ms);
+		si().timer->set(la, time_ns);
+		if (si().timer->is_worker() && time_ns > 0) wake_up(); // Пересчет времени засыпания
 	}
 
+	// Способ обработки таймеров, до первой установки таймера
+	static void timer_mode_set(int mode) noexcept {
+		si().timer_mode = mode;
+	}
+
+	#ifdef LT_STAT
+	// Снимок статистики в работе
+	static void stat_snapshot(lite_stat_snapshot_t& s) noexcept {
+		lite_thread_stat_t::snapshot(s);
+		s.time_us = lite_time_us();
+		s.thread_count = si().thread_count;
+		s.thread_work = thread_work();
+		s.actor_ready = lite_actor_t::count_ready();
+	}
+	#endif
+
 	// Завершение, ожидание всех потоков
 	static void end() noexcept {
-		// Рассчет еще не начался
-		if(si().thread_count == 1 && thread_work() == 0) {
-			#ifdef LT_DEBUG
-			lite_log(0, "--- wait start ---");
-			#endif	
-			std::this_thread::sleep_for(std::chrono::milliseconds(100)); // для запуска потоков
-		}
 		#ifdef LT_DEBUG
 		lite_log(0, "--- wait all ---");
 		#endif	
 		// Ожидание завершения расчетов. 
-		while(thread_work() > 0) {
-			std::unique_lock<std::mutex> lck(si().mtx_end);
-			si().cv_end.wait_for(lck, std::chrono::milliseconds(300));
-		}
+		lite_actor_t::wait_idle();
 		#ifdef LT_DEBUG
 		lite_log(0, "--- stop all ---");
 		#endif	
 		// Остановка таймеров
-		if (si().timer != NULL) {
-			delete si().timer;
-			si().timer = NULL;
-		}
+		if (si().timer != NULL) si().timer->stop_all();
 		// Остановка потоков
 		si().stop = true;
 		while(true) { // Ожидание остановки всех потоков
@@ -1715,6 +4338,10 @@ public: //-------------------------------------
 		}
 		// Завершены все потоки
 		assert(si().thread_count == 0);
+		if (si().timer != NULL) {
+			delete si().timer;
+			si().timer = NULL;
+		}
 
 		// Очистка данных потоков
 		lite_lock_t lck(si().mtx); // Блокировка
@@ -1731,6 +4358,8 @@ public: //-------------------------------------
 		lite_actor_t::clear();
 		// Очистка памяти под ресурсы
 		lite_resource_manage_t::clear();
+		// Возврат памяти пулов сообщений
+		lite_msg_pool_t::clear();
 		#ifdef LT_STAT
 		lite_thread_stat_t::ti().print_stat();
 		#endif		
@@ -1767,6 +4396,10 @@ public: //-------------------------------------
 #define LITE_LOG_BUF_SIZE 4096
 #endif
 
+#ifndef LT_LOG_RING_SIZE
+#define LT_LOG_RING_SIZE 0x10000 // Размер буфера записей лога потока, степень 2
+#endif
+
 // Сообщение
 struct lite_msg_log_t : public lite_msg_t {
 	lite_msg_log_t(int err, const char* str) : data(str), err_num(err) { }
@@ -1775,7 +4408,463 @@ struct lite_msg_log_t : public lite_msg_t {
 	int err_num;
 };
 
-// Вывод по умолчанию в консоль. При необходимости зарегистрировать свой актор "log"
+// Запись лога в буфере потока. За заголовком аргументы в порядке строки формата:
+// числа по 8 байт, строки - длина 8 байт и текст с 0 на конце, выровненный на 8
+struct lite_log_rec_t {
+	uint32_t size;		// Размер записи с заголовком, кратно 8. 0 - метка перехода на начало буфера
+	int32_t err;		// Код ошибки
+	const char* fmt;	// Строка формата
+	int64_t time;		// Время lite_time_ns()
+};
+
+// Кольцевой буфер записей лога одного потока. Пишет только поток-владелец, читает только вывод лога
+class lite_log_ring_t : public lite_align64_t {
+	alignas(64) std::atomic<size_t> head;	// Позиция записи
+	alignas(64) std::atomic<size_t> tail;	// Позиция чтения
+	alignas(64) char buf[LT_LOG_RING_SIZE];
+
+public:
+	std::atomic<size_t> dropped;	// Потеряно записей при переполнении
+	size_t dropped_out;				// Из них выведено в лог
+	std::atomic<bool> closed;		// Поток-владелец завершен
+	std::atomic<bool> alert;		// Вывод извещен о непрочитанных записях
+
+	lite_log_ring_t() : head(0), tail(0), dropped(0), dropped_out(0), closed(false), alert(false) {}
+
+	// Отметка о новой записи. true - вывод еще не извещен, нужно известить
+	bool alert_set() noexcept {
+		return !alert.exchange(true, std::memory_order_acq_rel);
+	}
+
+	// Снятие отметки перед чтением, следующая запись снова известит вывод
+	void alert_reset() noexcept {
+		alert.exchange(false, std::memory_order_acq_rel);
+	}
+
+	// Запись. false если нет места, запись теряется
+	bool write(const char* rec, size_t size) noexcept {
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t pos = h & (LT_LOG_RING_SIZE - 1);
+		size_t rest = LT_LOG_RING_SIZE - pos;
+		size_t need = (rest < size ? rest + size : size); // Не помещающаяся в конце запись пишется с начала
+		if (need > LT_LOG_RING_SIZE - (h - tail.load(std::memory_order_acquire))) {
+			dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return false;
+		}
+		if (rest < size) {
+			uint32_t wrap = 0;
+			memcpy(buf + pos, &wrap, sizeof(wrap));
+			h += rest;
+			pos = 0;
+		}
+		memcpy(buf + pos, rec, size);
+		head.store(h + size, std::memory_order_release);
+		return true;
+	}
+
+	// Первая непрочитанная запись, NULL если нет
+	const lite_log_rec_t* front() noexcept {
+		size_t t = tail.load(std::memory_order_relaxed);
+		while (t != head.load(std::memory_order_acquire)) {
+			size_t pos = t & (LT_LOG_RING_SIZE - 1);
+			uint32_t size;
+			memcpy(&size, buf + pos, sizeof(size));
+			if (size != 0) return (const lite_log_rec_t*)(buf + pos);
+			t += LT_LOG_RING_SIZE - pos; // Переход на начало буфера
+			tail.store(t, std::memory_order_release);
+		}
+		return NULL;
+	}
+
+	// Освобождение записи front()
+	void pop() noexcept {
+		size_t t = tail.load(std::memory_order_relaxed);
+		const lite_log_rec_t* rec = (const lite_log_rec_t*)(buf + (t & (LT_LOG_RING_SIZE - 1)));
+		tail.store(t + rec->size, std::memory_order_release);
+	}
+
+	bool empty() const noexcept {
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_relaxed);
+	}
+};
+
+// Асинхронный лог. lite_log() без блокировок копирует указатель на формат, время и аргументы в буфер
+// потока, форматирование и вывод выполняет актор lite_actor_log_t пачками
+class lite_log_t {
+	// Подстановка в строке формата printf
+	struct spec_t {
+		const char* begin;	// '%'
+		const char* len;	// Модификатор длины
+		const char* end;	// Символ после подстановки
+		char conv;			// Тип подстановки, 0 - неподдерживаемая
+		char size;			// Размер аргумента: 0 - int, 'H' - hh, 'h', 'l', 'q' - ll, 'L', 'z', 'j', 't'
+		int star;			// Количество '*' в ширине и точности
+	};
+
+	// Разбор подстановки, p указывает на '%'
+	static void spec_parse(const char* p, spec_t& s) noexcept {
+		s.begin = p++;
+		s.conv = 0;
+		s.size = 0;
+		s.star = 0;
+		while (*p != 0 && strchr("-+ #0'", *p) != NULL) p++;
+		if (*p == '*') {
+			s.star++;
+			p++;
+		}
+		while (*p >= '0' && *p <= '9') p++;
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				s.star++;
+				p++;
+			}
+			while (*p >= '0' && *p <= '9') p++;
+		}
+		s.len = p;
+		switch (*p) {
+		case 'h':
+			p++;
+			if (*p == 'h') {
+				p++;
+				s.size = 'H';
+			} else {
+				s.size = 'h';
+			}
+			break;
+		case 'l':
+			p++;
+			if (*p == 'l') {
+				p++;
+				s.size = 'q';
+			} else {
+				s.size = 'l';
+			}
+			break;
+		case 'q': case 'L': case 'z': case 'j': case 't':
+			s.size = *p++;
+			break;
+		case 'I': // MSVC: I64, I32, I
+			if (p[1] == '6' && p[2] == '4') {
+				s.size = 'q';
+				p += 3;
+			} else if (p[1] == '3' && p[2] == '2') {
+				p += 3;
+			} else {
+				s.size = 'z';
+				p++;
+			}
+			break;
+		}
+		if (*p != 0 && strchr("diouxXcsfFeEgGaApn%", *p) != NULL) s.conv = *p++;
+		s.end = p;
+	}
+
+	// Запись аргументов по строке формата в rec размером size. Возвращает размер записи
+	static size_t encode(char* rec, size_t size, const char* fmt, va_list ap) noexcept {
+		size_t n = sizeof(lite_log_rec_t);
+		for (const char* p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%')) {
+			spec_t s;
+			spec_parse(p, s);
+			p = s.end;
+			if (s.conv == 0) break; // Типы дальнейших аргументов неизвестны
+			if (n + 8 * (s.star + 1) > size) break;
+			if (s.conv == 's' && n + 8 * s.star + 9 > size) break; // Нет места под длину и завершающий 0 строки
+			for (int i = 0; i < s.star; i++) {
+				int64_t v = va_arg(ap, int);
+				memcpy(rec + n, &v, 8);
+				n += 8;
+			}
+			switch (s.conv) {
+			case '%':
+				break;
+			case 'n':
+				(void)va_arg(ap, int*);
+				break;
+			case 's': {
+				const char* str = va_arg(ap, const char*);
+				if (str == NULL) str = "(null)";
+				uint64_t len = strlen(str);
+				if (len > size - n - 9) len = size - n - 9;
+				memcpy(rec + n, &len, 8);
+				memcpy(rec + n + 8, str, (size_t)len);
+				rec[n + 8 + len] = 0;
+				n += (8 + (size_t)len + 1 + 7) & ~(size_t)7;
+				break;
+			}
+			case 'p': {
+				uint64_t v = (uintptr_t)va_arg(ap, void*);
+				memcpy(rec + n, &v, 8);
+				n += 8;
+				break;
+			}
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+				double v = (s.size == 'L' ? (double)va_arg(ap, long double) : va_arg(ap, double));
+				memcpy(rec + n, &v, 8);
+				n += 8;
+				break;
+			}
+			default: { // Целые
+				bool sign = (s.conv == 'd' || s.conv == 'i');
+				int64_t v;
+				switch (s.size) {
+				case 'H': v = sign ? (int64_t)(signed char)va_arg(ap, int) : (int64_t)(unsigned char)va_arg(ap, unsigned int); break;
+				case 'h': v = sign ? (int64_t)(short)va_arg(ap, int) : (int64_t)(unsigned short)va_arg(ap, unsigned int); break;
+				case 'l': v = sign ? (int64_t)va_arg(ap, long) : (int64_t)va_arg(ap, unsigned long); break;
+				case 'q': case 'L': v = sign ? (int64_t)va_arg(ap, long long) : (int64_t)va_arg(ap, unsigned long long); break;
+				case 'z': v = (int64_t)va_arg(ap, size_t); break;
+				case 'j': v = sign ? (int64_t)va_arg(ap, intmax_t) : (int64_t)va_arg(ap, uintmax_t); break;
+				case 't': v = (int64_t)va_arg(ap, ptrdiff_t); break;
+				default: v = sign ? (int64_t)va_arg(ap, int) : (int64_t)va_arg(ap, unsigned int); break;
+				}
+				memcpy(rec + n, &v, 8);
+				n += 8;
+				break;
+			}
+			}
+		}
+		return n;
+	}
+
+	// Форматирование записи
+	static void format(const lite_log_rec_t* rec, std::string& out) {
+		const char* a = (const char*)rec + sizeof(lite_log_rec_t);
+		const char* a_end = (const char*)rec + rec->size;
+		const char* p = rec->fmt;
+		char buf[LITE_LOG_BUF_SIZE];
+		while (*p != 0) {
+			const char* q = strchr(p, '%');
+			if (q == NULL) {
+				out += p;
+				break;
+			}
+			out.append(p, q - p);
+			spec_t s;
+			spec_parse(q, s);
+			p = s.end;
+			if (s.conv == 0 || a + 8 * (s.star + (s.conv != '%' && s.conv != 'n')) > a_end) { // Остаток без подстановок
+				out += q;
+				break;
+			}
+			if (s.conv == '%') {
+				out += '%';
+				continue;
+			}
+			if (s.conv == 'n') continue;
+			// Подстановка с шириной и точностью числами и размером аргумента по типу хранения
+			char f[64];
+			size_t fn = 0;
+			for (const char* c = s.begin; c < s.len && fn < 32; c++) {
+				if (*c == '*') {
+					int64_t v;
+					memcpy(&v, a, 8);
+					a += 8;
+					fn += snprintf(f + fn, sizeof(f) - fn, "%d", (int)v);
+				} else {
+					f[fn++] = *c;
+				}
+			}
+			if (strchr("diouxX", s.conv) != NULL) {
+				f[fn++] = 'l';
+				f[fn++] = 'l';
+			}
+			f[fn++] = s.conv;
+			f[fn] = 0;
+			uint64_t v;
+			memcpy(&v, a, 8);
+			a += 8;
+			switch (s.conv) {
+			case 's':
+				snprintf(buf, sizeof(buf), f, a);
+				a += ((size_t)v + 1 + 7) & ~(size_t)7;
+				break;
+			case 'p':
+				snprintf(buf, sizeof(buf), f, (void*)(uintptr_t)v);
+				break;
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+				double d;
+				memcpy(&d, &v, 8);
+				snprintf(buf, sizeof(buf), f, d);
+				break;
+			}
+			case 'c':
+				snprintf(buf, sizeof(buf), f, (int)v);
+				break;
+			case 'd': case 'i':
+				snprintf(buf, sizeof(buf), f, (long long)v);
+				break;
+			default:
+				snprintf(buf, sizeof(buf), f, (unsigned long long)v);
+				break;
+			}
+			out += buf;
+		}
+	}
+
+	// Строка лога для вывода
+	struct line_t {
+		int64_t time;
+		int err;
+		std::string text;
+
+		bool operator<(const line_t& l) const noexcept {
+			return time < l.time;
+		}
+	};
+
+	// static переменные уровня потока -------------------------------------------------
+	struct thread_info_t : public lite_thread_info_t<thread_info_t> {
+		lite_log_ring_t* ring = {0}; // Буфер записей потока
+
+		~thread_info_t() {
+			if (ring != NULL) ring->closed = true; // Буфер удаляется выводом лога после дочитывания
+			ring = NULL;
+		}
+	};
+
+	static thread_info_t& ti() noexcept {
+		return thread_info_t::tls_get();
+	}
+
+	// static переменные глобальные ----------------------------------------------------
+	struct static_info_t : public lite_static_info_t<static_info_t> {
+		std::vector<lite_log_ring_t*> ring_list;	// Буферы потоков
+		lite_mutex_t mtx;							// Блокировка ring_list и создания актора вывода
+		std::atomic<lite_actor_t*> out = {0};		// Актор вывода
+		size_t dropped = {0};						// Потеряно записей в удаленных буферах
+		int64_t wall_ns;							// Системное время, нс с 1970 года
+		int64_t mono_ns;							// lite_time_ns() в момент wall_ns
+
+		static_info_t() {
+			mono_ns = lite_time_ns();
+			wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		}
+	};
+
+	static static_info_t& si() noexcept {
+		return static_info_t::si();
+	}
+
+public:
+	// Дата и время в начале строки лога
+	static size_t date(char* p, size_t size, time_t t, int err) noexcept {
+		#ifdef WIN32
+		struct tm timeinfo;
+		localtime_s(&timeinfo, &t);
+		if (err > 0) {
+			return sprintf_s(p, size, "%02d.%02d.%02d %02d:%02d:%02d !!! ERROR %d: ", timeinfo.tm_mday, timeinfo.tm_mon, timeinfo.tm_year % 100, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, err);
+		} else {
+			return sprintf_s(p, size, "%02d.%02d.%02d %02d:%02d:%02d ", timeinfo.tm_mday, timeinfo.tm_mon, timeinfo.tm_year % 100, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
+		}
+		#else
+		struct tm * timeinfo;
+		timeinfo = localtime(&t);
+		if (err > 0) {
+			return snprintf(p, size, "%02d.%02d.%02d %02d:%02d:%02d !!! ERROR %d: ", timeinfo->tm_mday, timeinfo->tm_mon, timeinfo->tm_year % 100, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, err);
+		} else {
+			return snprintf(p, size, "%02d.%02d.%02d %02d:%02d:%02d ", timeinfo->tm_mday, timeinfo->tm_mon, timeinfo->tm_year % 100, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
+		}
+		#endif
+	}
+
+	// Запись в буфер потока, при переполнении запись теряется. true - нужно известить вывод
+	static bool write(int err, const char* fmt, va_list ap) noexcept {
+		thread_info_t& t = ti();
+		if (t.ring == NULL) {
+			t.ring = new lite_log_ring_t();
+			lite_lock_t lck(si().mtx); // Блокировка
+			si().ring_list.push_back(t.ring);
+		}
+		alignas(8) char rec[LITE_LOG_BUF_SIZE + sizeof(lite_log_rec_t)];
+		lite_log_rec_t* r = (lite_log_rec_t*)rec;
+		r->size = (uint32_t)((encode(rec, sizeof(rec), fmt, ap) + 7) & ~(size_t)7);
+		r->err = err;
+		r->fmt = fmt;
+		r->time = lite_time_ns();
+		t.ring->write(rec, r->size);
+		return t.ring->alert_set();
+	}
+
+	// Извещение о завершении потока, буфер потока удаляется выводом после дочитывания
+	static void thread_end() noexcept {
+		thread_info_t::tls_free();
+	}
+
+	// Актор вывода
+	static std::atomic<lite_actor_t*>& out() noexcept {
+		return si().out;
+	}
+
+	// Блокировка создания актора вывода
+	static lite_mutex_t& mtx() noexcept {
+		return si().mtx;
+	}
+
+	// Всего потеряно записей
+	static size_t dropped() noexcept {
+		lite_lock_t lck(si().mtx); // Блокировка
+		size_t n = si().dropped;
+		for (auto& r : si().ring_list) n += r->dropped;
+		return n;
+	}
+
+	// Вывод накопленных записей всех потоков в порядке времени. Вызывается только актором вывода self
+	static void flush(lite_actor_t* self) {
+		std::vector<lite_log_ring_t*> list;
+		{
+			lite_lock_t lck(si().mtx); // Блокировка
+			list = si().ring_list;
+		}
+		std::vector<line_t> lines;
+		for (auto& ring : list) {
+			bool closed = ring->closed;
+			ring->alert_reset(); // Записи после этого известят вывод снова
+			const lite_log_rec_t* rec;
+			while ((rec = ring->front()) != NULL) {
+				lines.push_back(line_t());
+				lines.back().time = rec->time;
+				lines.back().err = rec->err;
+				format(rec, lines.back().text);
+				ring->pop();
+			}
+			size_t dropped = ring->dropped;
+			if (dropped != ring->dropped_out) {
+				lines.push_back(line_t());
+				lines.back().time = lite_time_ns();
+				lines.back().err = LITE_ERROR_LOG_DROP;
+				lines.back().text = "log buffer full, lost " + std::to_string(dropped - ring->dropped_out) + " records";
+				ring->dropped_out = dropped;
+			}
+			if (closed && ring->empty()) { // Поток завершен, буфер дочитан
+				lite_lock_t lck(si().mtx); // Блокировка
+				si().ring_list.erase(std::find(si().ring_list.begin(), si().ring_list.end(), ring));
+				si().dropped += ring->dropped;
+				delete ring;
+			}
+		}
+		if (lines.empty()) return;
+		std::stable_sort(lines.begin(), lines.end());
+
+		static lite_actor_ref_t log_ref("log"); // Вызывается только из актора вывода
+		lite_actor_t* log = log_ref.get();
+		std::string text; // Вывод в консоль одной записью
+		char buf[64];
+		for (auto& l : lines) {
+			time_t t = (time_t)((si().wall_ns + l.time - si().mono_ns) / 1000000000);
+			size_t size = date(buf, sizeof(buf), t, l.err);
+			if (log == NULL || log == self) {
+				text.append(buf + 9, size - 9);
+				text += l.text;
+				text += '\n';
+			} else {
+				log->run(new lite_msg_log_t(l.err, (buf + l.text).c_str()));
+			}
+		}
+		if (!text.empty()) fwrite(text.data(), 1, text.size(), stdout);
+	}
+};
+
+// Вывод по умолчанию в консоль, выводит записи из буферов потоков. При необходимости зарегистрировать свой актор "log"
 class lite_actor_log_t : public lite_actor_t {
 public:
 	void recv(lite_msg_t* msg) override { // Обработчик сообщения
@@ -1783,62 +4872,279 @@ public:
 		assert(m != NULL);
 		printf("%s\n", m->data.c_str() + 9);
 	}
+
+	void timer() override { // Вызывается timer_alert() из lite_log()
+		lite_log_t::flush(this);
+	}
+
+	~lite_actor_log_t() {
+		lite_log_t::flush(this);
+		lite_actor_t* self = this;
+		lite_log_t::out().compare_exchange_strong(self, NULL);
+	}
+
+	// Актор вывода, создается при первой записи
+	static lite_actor_t* get() {
+		lite_actor_t* la = lite_log_t::out();
+		if (la != NULL) return la;
+		lite_lock_t lck(lite_log_t::mtx()); // Блокировка
+		la = lite_log_t::out();
+		if (la == NULL) {
+			la = new lite_actor_log_t();
+			lite_log_t::out() = la;
+			if (lite_actor_t::name_find("log") == NULL) la->name_set("log"); // Свой актор "log" не зарегистрирован
+		}
+		return la;
+	}
 };
 
 // Запись в лог
 static void lite_log(int err, const char* data, ...) noexcept {
 	va_list ap;
 	va_start(ap, data);
+	#ifdef LT_DEBUG_LOG
 	char buf[LITE_LOG_BUF_SIZE];
-
-	time_t rawtime;
-	time(&rawtime);
-
-	size_t size = 0;
-	char* p = buf;
-
-#ifdef WIN32
-	struct tm timeinfo;
-	localtime_s(&timeinfo, &rawtime);
-	if(err > 0) {
-		size += sprintf_s(p, LITE_LOG_BUF_SIZE - size, "%02d.%02d.%02d %02d:%02d:%02d !!! ERROR %d: ", timeinfo.tm_mday, timeinfo.tm_mon, timeinfo.tm_year % 100, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec, err);
-	} else {
-		size += sprintf_s(p, LITE_LOG_BUF_SIZE - size, "%02d.%02d.%02d %02d:%02d:%02d ", timeinfo.tm_mday, timeinfo.tm_mon, timeinfo.tm_year % 100, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
-	}
-	p += size;
-	size += vsprintf_s(p, LITE_LOG_BUF_SIZE - size, data, ap);
-	p += size;
-#else
-	struct tm * timeinfo;
-	timeinfo = localtime(&rawtime);
-	if (err > 0) {
-		size += snprintf(p, LITE_LOG_BUF_SIZE - size, "%02d.%02d.%02d %02d:%02d:%02d !!! ERROR %d: ", timeinfo->tm_mday, timeinfo->tm_mon, timeinfo->tm_year % 100, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec, err);
-	} else {
-		size += snprintf(p, LITE_LOG_BUF_SIZE - size, "%02d.%02d.%02d %02d:%02d:%02d ", timeinfo->tm_mday, timeinfo->tm_mon, timeinfo->tm_year % 100, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
-	}
-	p += size;
-	size += vsnprintf(p, LITE_LOG_BUF_SIZE - size, data, ap);
-	p += size;
-#endif
+	size_t size = lite_log_t::date(buf, LITE_LOG_BUF_SIZE, time(NULL), err);
+	#ifdef WIN32
+	vsprintf_s(buf + size, LITE_LOG_BUF_SIZE - size, data, ap);
+	#else
+	vsnprintf(buf + size, LITE_LOG_BUF_SIZE - size, data, ap);
+	#endif
 	va_end(ap);
-	assert(size < LITE_LOG_BUF_SIZE);
-	*p = 0;
 	lite_msg_log_t* msg = new lite_msg_log_t(err, buf);
-	// Отправка на вывод
+	// Вывод сразу
 	lite_actor_t* log = lite_actor_t::name_find("log");
 	if(log == NULL) { // Нет актора "log"
 		// Регистрация lite_actor_log_t()
 		log = new lite_actor_log_t();
 		log->name_set("log");
 	}
-	#ifdef LT_DEBUG_LOG
 	log->recv(msg);
 	delete msg;
 	#else
-	log->run(msg);
+	bool alert = lite_log_t::write(err, data, ap);
+	va_end(ap);
+	if (alert) lite_actor_log_t::get()->timer_alert(); // Вывод актором, если он еще не извещен
 	#endif
 }
 
+// Извещение лога о завершении потока
+static void lite_log_thread_end() noexcept {
+	lite_log_t::thread_end();
+}
+
+//----------------------------------------------------------------------------------
+//----- ПАРАЛЛЕЛЬНЫЙ ЦИКЛ ----------------------------------------------------------
+//----------------------------------------------------------------------------------
+
+// Задание параллельного цикла. Участник берет из очереди наибольший диапазон и делит его пополам,
+// отдавая правые половины другим, пока не останется часть не более grain
+class lite_for_job_t {
+	std::function<void(size_t, size_t)> fn;
+	size_t grain;
+	std::mutex mtx;
+	std::deque<std::pair<size_t, size_t>> ranges;	// Ожидающие выполнения диапазоны, в начале наибольшие
+	std::atomic<size_t> left;						// Количество невыполненных итераций
+	std::condition_variable cv;						// Ожидание выполнения всех итераций
+	std::exception_ptr error;						// Первое исключение из fn
+	std::atomic<bool> failed;						// После исключения оставшиеся части пропускаются
+
+	bool take(size_t& b, size_t& e) {
+		std::lock_guard<std::mutex> lck(mtx);
+		if (ranges.empty()) return false;
+		b = ranges.front().first;
+		e = ranges.front().second;
+		ranges.pop_front();
+		return true;
+	}
+
+	void put(size_t b, size_t e) {
+		std::lock_guard<std::mutex> lck(mtx);
+		ranges.push_back(std::make_pair(b, e));
+	}
+
+public:
+	lite_for_job_t(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn) :
+		fn(fn), grain(grain), left(end - begin), failed(false) {
+		ranges.push_back(std::make_pair(begin, end));
+	}
+
+	// Выполнение частей, пока есть ожидающие диапазоны
+	void work() {
+		size_t b, e;
+		while (take(b, e)) {
+			while (e - b > grain) {
+				size_t mid = b + (e - b) / 2;
+				put(mid, e);
+				e = mid;
+			}
+			if (!failed.load(std::memory_order_relaxed)) {
+				try {
+					fn(b, e);
+				} catch (...) {
+					std::lock_guard<std::mutex> lck(mtx);
+					if (!error) error = std::current_exception();
+					failed = true;
+				}
+			}
+			if (left.fetch_sub(e - b) == e - b) {
+				std::lock_guard<std::mutex> lck(mtx);
+				cv.notify_all();
+			}
+		}
+	}
+
+	// Ожидание выполнения всех итераций, затем повторный выброс первого исключения из fn
+	void wait() {
+		std::unique_lock<std::mutex> lck(mtx);
+		cv.wait(lck, [this] { return left.load() == 0; });
+		if (error) std::rethrow_exception(error);
+	}
+};
+
+// Сообщение помощнику: участие в задании
+struct lite_for_msg_t : public lite_msg_t {
+	std::shared_ptr<lite_for_job_t> job;
+
+	lite_for_msg_t(const std::shared_ptr<lite_for_job_t>& job) : job(job) {}
+};
+
+// Помощники параллельного цикла в рабочих потоках, создается при первом использовании
+class lite_for_actor_t : public lite_actor_t {
+	void recv(lite_msg_t* msg) override {
+		static_cast<lite_for_msg_t*>(msg)->job->work();
+	}
+
+	static std::atomic<lite_for_actor_t*>& inst() {
+		static std::atomic<lite_for_actor_t*> la(NULL);
+		return la;
+	}
+
+	static lite_for_actor_t* get() {
+		lite_for_actor_t* la = inst();
+		if (la != NULL) return la;
+		static lite_mutex_t mtx;
+		lite_lock_t lck(mtx); // Блокировка
+		la = inst();
+		if (la == NULL) {
+			la = new lite_for_actor_t();
+			la->parallel_set(LT_READY_QUEUES);
+			inst() = la;
+		}
+		return la;
+	}
+
+public:
+	~lite_for_actor_t() {
+		lite_for_actor_t* self = this;
+		inst().compare_exchange_strong(self, NULL);
+	}
+
+	// Выполнение fn(b, e) частями [begin, end) не более grain в вызывающем потоке и помощниках
+	static void parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+		if (begin >= end) return;
+		if (grain == 0) grain = 1;
+		size_t parts = (end - begin - 1) / grain + 1;
+		size_t threads = std::max((size_t)std::thread::hardware_concurrency(), lite_thread_t::pool_get());
+		size_t helpers = std::min(parts, threads) - 1;
+		std::shared_ptr<lite_for_job_t> job = std::make_shared<lite_for_job_t>(begin, end, grain, fn);
+		if (helpers != 0) {
+			lite_for_actor_t* la = get();
+			for (size_t i = 0; i < helpers; i++) la->run(new lite_for_msg_t(job));
+			next_run_flush(); // Помощник не должен ждать завершения текущего актора
+		}
+		job->work(); // Вызывающий поток участвует наравне с помощниками
+		job->wait(); // Завершение частей, взятых помощниками
+	}
+};
+
+#ifdef LT_STAT
+//----------------------------------------------------------------------------------
+//----- ВЫГРУЗКА СТАТИСТИКИ --------------------------------------------------------
+//----------------------------------------------------------------------------------
+#define LT_STAT_JSON 0	// Строка выгрузки - объект JSON
+#define LT_STAT_CSV 1	// Строка выгрузки - значения через запятую, первой строкой заголовок
+
+// Периодическая запись снимков статистики в файл или в лог. Скорость и доли попаданий за период
+class lite_actor_stat_t : public lite_actor_t {
+	FILE* file;					// Файл, NULL - вывод в лог
+	int format;					// LT_STAT_JSON или LT_STAT_CSV
+	bool header;				// Заголовок CSV записан
+	lite_stat_snapshot_t prev;	// Предыдущий снимок
+
+	// Доля a от b
+	static double ratio(size_t a, size_t b) noexcept {
+		return b > 0 ? (double)a / b : 0;
+	}
+
+	void write(const char* line) {
+		if (file != NULL) {
+			fprintf(file, "%s\n", line);
+			fflush(file);
+		} else {
+			lite_log(0, "%s", line);
+		}
+	}
+
+public:
+	lite_actor_stat_t(FILE* file, int format) : file(file), format(format), header(false) {
+		lite_thread_t::stat_snapshot(prev);
+	}
+
+	~lite_actor_stat_t() {
+		if (file != NULL) fclose(file);
+	}
+
+	void recv(lite_msg_t*) override {
+	}
+
+	void timer() override {
+		lite_stat_snapshot_t s;
+		lite_thread_t::stat_snapshot(s);
+		int64_t time_us = s.time_us - prev.time_us;
+		double msg_sec = time_us > 0 ? (double)(s.stat_msg_send - prev.stat_msg_send) * 1000000 / time_us : 0;
+		size_t cache_found = s.stat_cache_found - prev.stat_cache_found; // actor_find считается только после промаха кэша
+		double cache_hit = ratio(cache_found, cache_found + s.stat_actor_find - prev.stat_actor_find);
+		size_t pool_hit = s.stat_pool_hit - prev.stat_pool_hit;
+		double pool_ratio = ratio(pool_hit, pool_hit + s.stat_pool_miss - prev.stat_pool_miss);
+		char buf[LITE_LOG_BUF_SIZE];
+		size_t n;
+		if (format == LT_STAT_CSV) {
+			if (!header) {
+				#ifdef LT_STAT_QUEUE
+				write("time_us,threads,threads_work,actors,actors_ready,msg_live,msg_send,msg_sec,queue_max,cache_hit,pool_hit,wake_up,steal");
+				#else
+				write("time_us,threads,threads_work,actors,actors_ready,msg_live,msg_send,msg_sec,cache_hit,pool_hit,wake_up,steal");
+				#endif
+				header = true;
+			}
+			n = snprintf(buf, sizeof(buf), "%lld,%llu,%llu,%llu,%llu,%lld,%llu,%.0f,",
+				(long long)s.time_us, (unsigned long long)s.thread_count, (unsigned long long)s.thread_work,
+				(long long)(s.stat_actor_create - s.stat_actor_erase), (unsigned long long)s.actor_ready,
+				(long long)(s.stat_msg_create - s.stat_msg_erase), (unsigned long long)s.stat_msg_send, msg_sec);
+			#ifdef LT_STAT_QUEUE
+			n += snprintf(buf + n, sizeof(buf) - n, "%llu,", (unsigned long long)s.stat_queue_max);
+			#endif
+			snprintf(buf + n, sizeof(buf) - n, "%.3f,%.3f,%llu,%llu", cache_hit, pool_ratio,
+				(unsigned long long)s.stat_thread_wake_up, (unsigned long long)s.stat_actor_steal);
+		} else {
+			n = snprintf(buf, sizeof(buf), "{\"time_us\":%lld,\"threads\":%llu,\"threads_work\":%llu,\"actors\":%lld,"
+				"\"actors_ready\":%llu,\"msg_live\":%lld,\"msg_send\":%llu,\"msg_sec\":%.0f,",
+				(long long)s.time_us, (unsigned long long)s.thread_count, (unsigned long long)s.thread_work,
+				(long long)(s.stat_actor_create - s.stat_actor_erase), (unsigned long long)s.actor_ready,
+				(long long)(s.stat_msg_create - s.stat_msg_erase), (unsigned long long)s.stat_msg_send, msg_sec);
+			#ifdef LT_STAT_QUEUE
+			n += snprintf(buf + n, sizeof(buf) - n, "\"queue_max\":%llu,", (unsigned long long)s.stat_queue_max);
+			#endif
+			snprintf(buf + n, sizeof(buf) - n, "\"cache_hit\":%.3f,\"pool_hit\":%.3f,\"wake_up\":%llu,\"steal\":%llu}",
+				cache_hit, pool_ratio, (unsigned long long)s.stat_thread_wake_up, (unsigned long long)s.stat_actor_steal);
+		}
+		write(buf);
+		prev = s;
+	}
+};
+#endif
+
 //----------------------------------------------------------------------------------
 //----- ОБЕРТКИ --------------------------------------------------------------------
 //----------------------------------------------------------------------------------
@@ -1866,11 +5172,21 @@ static void lite_thread_end() noexcept {
 	lite_thread_t::end();
 }
 
+// Ожидание отсутствия работы без завершения, не вызывать из акторов
+static void lite_thread_wait_idle() noexcept {
+	lite_actor_t::wait_idle();
+}
+
 // Номер текущего потока
 static size_t lite_thread_num() noexcept {
 	return lite_thread_t::this_num();
 }
 
+// Количество рабочих потоков: размер пула lite_thread_pool(), без пула - количество ядер
+static size_t lite_thread_workers() noexcept {
+	return lite_thread_t::worker_count();
+}
+
 // Установка максимума ресурсу по умолчанию
 static void lite_thread_max(int max) noexcept {
 	return lite_actor_t::resource_max(max);
@@ -1887,13 +5203,82 @@ static T* lite_msg_copy(T* msg) noexcept {
 	return lite_actor_t::msg_copy(msg);
 }
 
+// Рассылка сообщения нескольким акторам без копирования
+template <typename T>
+static void lite_msg_share(T* msg, std::initializer_list<lite_actor_t*> list) noexcept {
+	lite_actor_t::msg_share(msg, list.begin(), list.size());
+}
+
+// Рассылка сообщения акторам списка без копирования
+template <typename T>
+static void lite_msg_share(T* msg, const std::vector<lite_actor_t*>& list) noexcept {
+	lite_actor_t::msg_share(msg, list.data(), list.size());
+}
+
+// Параллельный цикл: fn(b, e) для частей [begin, end) не более grain итераций. Части выполняются
+// рабочими потоками и вызывающим, возврат после выполнения всех. Первое исключение из fn выбрасывается
+// из lite_parallel_for() после завершения взятых частей
+static void lite_parallel_for(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn) {
+	lite_for_actor_t::parallel_for(begin, end, grain, fn);
+}
+
 // Пробуждение потока
 static void lite_thread_wake_up() noexcept {
 	lite_thread_t::wake_up();
 }
 
+// Привязка потоков к процессорам, вызывать до запуска потоков
+static void lite_thread_affinity(int policy, const std::vector<int>& cpu_list = std::vector<int>()) {
+	lite_topology_t::policy_set(policy, cpu_list);
+}
+
+// Пул из count заранее запущенных потоков, ожидающих работу spin_us мкс перед засыпанием
+static void lite_thread_pool(size_t count, int spin_us = 0) noexcept {
+	lite_thread_t::pool_set(count, spin_us);
+}
+
+// Описание привязки потоков к процессорам
+static std::string lite_thread_affinity_descr() {
+	return lite_topology_t::descr();
+}
+
 // Запуск с повторами по таймеру
 static void lite_timer_run(lite_actor_t* actor, int time_ms) noexcept {
-	lite_thread_t::timer_set(actor, time_ms);
+	lite_thread_t::timer_set(actor, (int64_t)time_ms * 1000000);
+}
+
+// Запуск с повторами по таймеру, период в микросекундах
+static void lite_timer_run_us(lite_actor_t* actor, int64_t time_us) noexcept {
+	lite_thread_t::timer_set(actor, time_us * 1000);
+}
+
+// Обработка таймеров: LT_TIMER_THREAD - отдельным потоком, LT_TIMER_WORKER - рабочими потоками
+static void lite_timer_mode(int mode) noexcept {
+	lite_thread_t::timer_mode_set(mode);
+}
+
+// Количество записей лога, потерянных при переполнении буферов потоков
+static size_t lite_log_dropped() noexcept {
+	return lite_log_t::dropped();
 }
+
+#ifdef LT_STAT
+// Снимок счетчиков статистики всех потоков без остановки работы
+static void lite_stat_snapshot(lite_stat_snapshot_t& s) noexcept {
+	lite_thread_t::stat_snapshot(s);
+}
+
+// Запись статистики каждые period_ms мс в файл file_name (дописывается) или в лог при file_name = NULL.
+// format: LT_STAT_JSON или LT_STAT_CSV. Запись прекращается в lite_thread_end()
+static bool lite_stat_export(const char* file_name, int format = LT_STAT_JSON, int period_ms = 1000) {
+	FILE* f = NULL;
+	if (file_name != NULL) {
+		f = fopen(file_name, "a");
+		if (f == NULL) return false;
+	}
+	lite_actor_t* la = new lite_actor_stat_t(f, format);
+	la->timer_set(period_ms);
+	return true;
+}
+#endif
 #pragma warning( pop )